@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Where copies of request and response data and growing buffers end up
+#define ALLOC_STATS_LARGE 4096
+// Power of two buckets of the per request histograms
+#define ALLOC_STATS_BUCKETS 40
+
+// Parts of handling a request its allocations are charged to
+enum allocPhases
+{
+    PHASE_RECV,
+    PHASE_PARSE,
+    PHASE_ROUTE,
+    PHASE_HANDLER,
+    PHASE_SERIALIZE,
+    PHASE_SEND,
+    PHASE_COUNT
+};
+
+struct AllocCounters
+{
+    uint64_t allocations;
+    uint64_t bytes;
+    uint64_t large;
+};
+
+// Allocations of a client's current request by phase, counted only with make ALLOC_STATS=1
+class AllocRecord
+{
+    public:
+#ifdef ALLOC_STATS
+        AllocCounters phases[PHASE_COUNT];
+
+        AllocRecord();
+        void finish(int fd);
+#else
+        void finish(int) {}
+#endif
+};
+
+// Charges the thread's allocations to one phase, a nested scope takes over until it ends
+class AllocScope
+{
+#ifdef ALLOC_STATS
+    private:
+        AllocCounters* target;
+        AllocCounters start;
+        AllocScope* outer;
+
+    public:
+        AllocScope(AllocRecord& record, allocPhases phase);
+        ~AllocScope();
+
+        void flush();
+#else
+    public:
+        AllocScope(AllocRecord&, allocPhases) {}
+#endif
+        AllocScope(const AllocScope& copy) = delete;
+        AllocScope& operator=(const AllocScope& copy) = delete;
+};
+
+// Histograms of all the requests finished so far, written to the log at exit
+#ifdef ALLOC_STATS
+void reportAllocStats();
+#else
+inline void reportAllocStats() {}
+#endif
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+
+// Byte buffer with read and write offsets, live bytes only move when the tail runs out
+class Buffer
+{
+    private:
+        std::pmr::memory_resource* resource;
+        char* storage;
+        size_t capacity;
+        size_t readPos;
+        size_t writePos;
+
+        void makeRoom(size_t bytes);
+
+    public:
+        explicit Buffer(std::pmr::memory_resource* resource = std::pmr::new_delete_resource());
+        Buffer(const Buffer& copy);
+        Buffer& operator=(const Buffer& copy);
+        Buffer(Buffer&& other) noexcept;
+        Buffer& operator=(Buffer&& other) noexcept;
+        ~Buffer();
+
+        size_t size() const;
+        size_t reserved() const;
+        bool empty() const;
+        const char* data() const;
+        std::string_view view() const;
+
+        char* prepare(size_t bytes);
+        void commit(size_t bytes);
+        void append(std::string_view bytes);
+        void assign(std::string_view bytes);
+        void reserve(size_t bytes);
+
+        void consume(size_t bytes);
+        void truncate(size_t bytes);
+        void clear();
+        void release();
+};
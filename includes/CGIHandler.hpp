@@ -2,6 +2,7 @@
 #include "Logger.hpp"
 #include "HTTPRequest.hpp"
 #include "HTTPResponse.hpp"
+#include "EventSource.hpp"
 #include "utils.hpp"
 #include <fcntl.h>
 #include <limits.h>
@@ -14,6 +15,12 @@ std::string joinPaths(std::filesystem::path path1, std::filesystem::path path2);
 
 class Client;
 
+// Parent end of a CGI pipe while it is registered in the event loop, fd is -1 otherwise
+struct CGIPipe : public EventSource
+{
+    Client* client;
+};
+
 class CGIHandler
 {
     private:
@@ -25,19 +32,23 @@ class CGIHandler
         std::vector<char*> execveArgs;
         int writeCGIPipe[2];
         int readCGIPipe[2];
+        CGIPipe childStdin;
+        CGIPipe childStdout;
+        size_t bodySent;
         pid_t childPid;
         std::string fullPath;
         std::string inputFilePath;
         std::string output;
         std::string tempFileName;
         bool fileOpen;
-        char absPath[PATH_MAX];
         
         CGIHandler();
-        void            setEnvValues(HTTPRequest& request, ServerConfig server);
-        void            writeBodyToChild(HTTPRequest& request);
-        HTTPResponse    generateCGIResponse(std::map<int, std::string> error_pages);
-        void            collectCGIOutput(int readFd);
+        void            reset();
+        void            setEnvValues(HTTPRequest& request, const ServerConfig& server);
+        int             writeBodyToChild(HTTPRequest& request);
+        HTTPResponse    generateCGIResponse(const std::map<int, std::string>& error_pages, size_t bodySize = std::string::npos);
+        int             collectCGIOutput(int readFd);
+        void            closePipes();
         int             getWritePipe();
         int             getReadPipe();
         int             getChildPid();
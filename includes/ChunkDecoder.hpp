@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+
+// Longest chunk extension or trailer line accepted
+#define MAX_CHUNK_LINE 4096
+
+// Where the decoder is in the chunked framing
+enum chunkStates
+{
+    CHUNK_SIZE,
+    CHUNK_SIZE_SPACE,
+    CHUNK_EXTENSION,
+    CHUNK_SIZE_LF,
+    CHUNK_DATA,
+    CHUNK_DATA_CR,
+    CHUNK_DATA_LF,
+    CHUNK_TRAILER_START,
+    CHUNK_TRAILER,
+    CHUNK_TRAILER_LF,
+    CHUNK_END_LF,
+    CHUNK_DONE,
+    CHUNK_ERROR
+};
+
+// Decodes a chunked body as it arrives, keeping its state between reads; extensions and trailers are dropped
+class ChunkDecoder
+{
+    private:
+        size_t chunkSize;
+        size_t digits;
+        size_t remaining;
+        size_t lineLength;
+        size_t trailerLength;
+
+        void step(char c);
+        void fail();
+
+    public:
+        enum chunkStates state;
+        // Body bytes decoded so far
+        size_t bodySize;
+
+        ChunkDecoder();
+        void reset();
+        size_t expected() const;
+        size_t decode(std::string_view input, std::string_view& data);
+};
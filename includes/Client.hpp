@@ -1,14 +1,25 @@
 #pragma once
 
+#include "AllocStats.hpp"
+#include "Buffer.hpp"
 #include "CGIHandler.hpp"
+#include "ChunkDecoder.hpp"
+#include "EventSource.hpp"
 #include "HTTPResponse.hpp"
 #include "HTTPRequest.hpp"
 #include "Parser.hpp"
+#include "TimerWheel.hpp"
+#include <memory_resource>
+#include <span>
 #include <string>
 #include <vector>
 #include <chrono>
 
+// Doubles while reads fill it up, halves while they leave most of it unused
 #define READ_BUFFER_SIZE 8192
+#define MAX_READ_BUFFER_SIZE (256 * 1024)
+// First block of the request arena, enough for a typical request and response
+#define REQUEST_ARENA_SIZE 2048
 
 enum connectionStates {
     IDLE,
@@ -17,36 +28,60 @@ enum connectionStates {
     SEND
 };
 
-class Client {
+enum deadlineTypes {
+    HEADER_DEADLINE,
+    BODY_DEADLINE,
+    CGI_DEADLINE,
+    SEND_DEADLINE,
+    TRIM_DEADLINE,
+    IDLE_DEADLINE
+};
+
+class Client : public EventSource {
     public:
-        int fd;
         std::chrono::steady_clock::time_point timestamp;
         enum connectionStates state;
+        TimerNode timer;
+        enum deadlineTypes deadline;
 
         std::string headerString;
-        std::string rawReadData;
-        size_t      previousDataAmount;;
-        std::string readBuffer;
-        std::string writeBuffer;
-        std::string chunkBuffer;
+        Buffer      rawReadData;
+        Buffer      writeBuffer;
+        ChunkDecoder chunked;
         int         bytesRead;
+        size_t      readSize;
+        bool        readPending;
+        // Not read while the memory budget is over its high watermark
+        bool        readPaused;
+        size_t      charged;
         int         bytesWritten;
         size_t      bytesSent;
-        size_t      chunkBodySize;
+        size_t      bodySent;
+        size_t      responseSize;
         bool erase;
+        // Counted in an ALLOC_STATS build only
+        AllocRecord allocStats;
+
+        std::span<const ServerConfig* const>    serverInfoAll;
+        const ServerConfig*                     serverInfo;
 
-        std::vector<ServerConfig>   serverInfoAll;
-        ServerConfig                serverInfo;
+        // Released all at once in reset(), declared before its users so it outlives them
+        std::pmr::monotonic_buffer_resource     arena;
 
         HTTPRequest                     request;
         std::vector<HTTPResponse>       response;
         CGIHandler                      CGI;
 
-        Client(int loop, int serverSocket, std::map<int, Client>& clients, std::vector<ServerConfig> server);
-        Client(const Client& copy);
-        Client& operator=(const Client& copy);
+        Client(int fd, std::span<const ServerConfig* const> server, std::pmr::memory_resource* pool);
+        // The poller, the timer wheel and the CGI pipes hold its address
+        Client(const Client& copy) = delete;
+        Client& operator=(const Client& copy) = delete;
         ~Client();
 
-        void findCorrectHost(const std::string headerString, const std::vector<ServerConfig>& serverInfoAll);
+        void attach(int fd, std::span<const ServerConfig* const> server);
+        void findCorrectHost();
         void reset();
+        void shrink(size_t limit);
+        void trim();
+        size_t memoryUsage() const;
 };
\ No newline at end of file
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "Poller.hpp"
+
+class EpollPoller : public Poller
+{
+    private:
+        int epollFd;
+
+    public:
+        EpollPoller();
+        EpollPoller(const EpollPoller& copy) = delete;
+        EpollPoller& operator=(const EpollPoller& copy) = delete;
+        ~EpollPoller();
+
+        int add(EventSource& source, uint32_t events);
+        int remove(EventSource& source);
+        int wait(std::vector<epoll_event>& events, int timeout);
+        int accept(EventSource& listener);
+        ssize_t receive(EventSource& source, char* buffer, size_t size);
+        const char* name() const;
+};
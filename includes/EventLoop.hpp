@@ -3,47 +3,109 @@
 
 #include <string>
 #include <map>
+#include <unordered_map>
+#include <memory>
+#include <memory_resource>
 #include <vector>
 #include <sys/epoll.h>
 
 #include "Client.hpp"
+#include "EventSource.hpp"
 #include "Parser.hpp"
+#include "Poller.hpp"
 #include "Logger.hpp"
+#include "MemoryBudget.hpp"
+#include "TimerWheel.hpp"
 
 #define MAX_CONNECTIONS 1024
+// Closed clients kept for reuse by the next connections
+#define CLIENT_POOL_SIZE 256
 #define TIMEOUT 60
-#define CHILD_CHECK 1
-#define DEFAULT_MAX_HEADER_SIZE 8192
+#define HEADER_TIMEOUT 30
+#define BODY_TIMEOUT 30
+#define SEND_TIMEOUT 30
+#define KEEPALIVE_TIMEOUT TIMEOUT
+// Idle keep-alive clients keep the buffers of their last request this long
+#define IDLE_TRIM_TIMEOUT 5
+#define CGI_TIMEOUT TIMEOUT
+// Bytes one client may read per wakeup before the others get their turn
+#define READ_BUDGET (1024 * 1024)
+// Largest block the buffer pool keeps for reuse, bigger ones come from the heap
+#define BUFFER_POOL_LARGEST_BLOCK (64 * 1024)
 #define DEBUG_LOGS false
 
+struct Listener : public EventSource
+{
+    std::vector<const ServerConfig*> serverConfigs;
+};
+
+// A CGI child watched through its pidfd, client is cleared when the client goes first
+struct ChildProcess : public EventSource
+{
+    pid_t pid;
+    Client* client;
+};
+
 class EventLoop
 {
     public:
-        int nChildren;
-        int loop;
-        int status;
+        int id;
+        std::unique_ptr<Poller> poller;
+        GlobalConfig globalConfig;
+        MemoryBudget& memoryBudget;
         
-        std::map<int, std::vector<ServerConfig>> servers;
-        std::map<int, Client> clients;
-        int serverSocket;
+        std::vector<std::unique_ptr<Listener>> listeners;
+        // Declared before the clients so it outlives them
+        std::pmr::unsynchronized_pool_resource bufferPool;
+        // Indexed by fd, the objects never move so epoll can point straight at them
+        std::vector<std::unique_ptr<Client>> clients;
+        size_t nClients;
+        std::vector<std::unique_ptr<Client>> closedClients;
+        std::vector<std::unique_ptr<Client>> freeClients;
+        // Clients that used up their read budget with data still in the socket
+        std::vector<Client*> pendingReads;
+        // Clients not read while the memory budget is over its high watermark
+        std::vector<Client*> pausedReads;
+        std::unordered_map<pid_t, std::unique_ptr<ChildProcess>> children;
+        TimerWheel timers;
+        std::vector<EventSource*> expiredTimers;
+        // eventfd that gets this loop out of its wait from another thread
+        EventSource wakeup;
         std::vector<epoll_event> eventLog;
-        struct itimerspec timerValues;
-        pid_t pid;
-        std::string checkConnection;
-        std::chrono::steady_clock::time_point lastTimeoutCheck;
-        std::chrono::steady_clock::time_point lastChildrenCheck;
+        // Read once per loop iteration
+        std::chrono::steady_clock::time_point now;
 
-        EventLoop(std::vector<ServerConfig> serverConfigs);
+        EventLoop(const std::vector<ServerConfig>& serverConfigs, const GlobalConfig& globalConfig, MemoryBudget& memoryBudget, int workerId);
+        EventLoop(const EventLoop& copy) = delete;
+        EventLoop& operator=(const EventLoop& copy) = delete;
         bool validateRequestMethod(Client &client);
         void startLoop();
         void timestamp();
-        void checkTimeouts();
+        void wake();
+        void setDeadline(Client& client, enum deadlineTypes deadline);
+        void expireDeadlines();
+        void acceptClient(Listener& listener);
+        void addClient(Listener& listener, int fd);
         void closeClient(int fd);
+        void removeClient(int fd);
+        void recycleClients();
+        void progressClient(Client& client);
+        void resumeReads();
+        void chargeMemory(Client& client);
+        void balanceMemory();
         void createErrorResponse(Client &client, int code, std::string msg, std::string logMsg);
         void handleClientRecv(Client& client, uint32_t event);
         void handleClientSend(Client &client);
-        void checkChildrenStatus();
-        void checkBody(Client &client, uint32_t eventType);
+        int  trackChild(Client& client);
+        void releaseChild(Client& client);
+        void handleChildExit(ChildProcess& child);
+        void finishCGI(Client& client, int status);
+        int  watchCGIPipe(Client& client, CGIPipe& pipe, int fd, uint32_t events);
+        void unwatchCGIPipe(CGIPipe& pipe);
+        void closeCGIPipes(Client& client);
+        void handleCGIInput(Client& client);
+        void handleCGIOutput(Client& client);
+        void checkBody(Client &client);
         void handleCGI(Client& client, uint32_t eventType);
         int  executeCGI(Client& client);
         int  checkMaxSize(Client& client);
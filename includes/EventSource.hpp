@@ -0,0 +1,18 @@
+#pragma once
+
+enum eventSourceTypes
+{
+    LISTENER,
+    CLIENT,
+    WAKEUP,
+    CHILD,
+    CGI_STDIN,
+    CGI_STDOUT
+};
+
+// Everything registered in the poller begins with this tag, data.ptr points at it
+struct EventSource
+{
+    enum eventSourceTypes sourceType;
+    int fd;
+};
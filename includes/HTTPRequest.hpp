@@ -1,10 +1,19 @@
 
 #pragma once
 
+#include "HeaderTable.hpp"
 #include "Parser.hpp"
 #include <string>
+#include <string_view>
 #include <vector>
 #include <map>
+#include <memory_resource>
+
+// Largest request header block, a longer one is refused before it is complete
+#define DEFAULT_MAX_HEADER_SIZE 8192
+
+// Names and values come from the client's request arena, std::less<> avoids temporary keys
+typedef std::pmr::map<std::pmr::string, std::pmr::string, std::less<>> HeaderMap;
 
 enum reqTypes
 {
@@ -14,10 +23,34 @@ enum reqTypes
     INVALID
 };
 
+// scanHeader() carries on from where it stopped with the bytes received next
+enum headerStates
+{
+    HEADER_REQUEST_LINE,
+    HEADER_FIELDS,
+    HEADER_COMPLETE,
+    HEADER_TOO_LARGE
+};
+
+// A field line of the header block, as offsets from its start
+struct FieldSpan
+{
+    size_t name;
+    size_t nameLength;
+    size_t value;
+    size_t valueLength;
+};
+
 class HTTPRequest
 {
     private:
-        void parser(std::string headers, ServerConfig server);
+        // Where the header block scan is: the line being received and how far it was searched
+        size_t lineStart;
+        size_t scanned;
+        size_t requestLineLength;
+        std::pmr::vector<FieldSpan> fields;
+
+        void addField(std::string_view line, size_t start);
 
     public:
         std::string method;
@@ -28,15 +61,29 @@ class HTTPRequest
         std::string location;
         std::string query;
         std::string pathInfo;
-        std::map<std::string, std::string> headers;
+        // Names and values point into the header block they were parsed from
+        HeaderTable headers;
+        headerStates headerState;
+        // Length of the header block with its empty line, once it is complete
+        size_t headerLength;
+        // A broken field line or percent escape
+        bool malformed;
         std::string body;
         std::string tempFileName;
         int fileFd;
+        // Unnamed file a large plain upload is written to, named once the request succeeded
+        int uploadFd;
+        size_t uploadSize;
+        size_t uploadWritten;
         bool fileUsed;
         bool fileIsOpen;
         bool isCGI;
         bool multipart;
         bool validHostName;
-        HTTPRequest();
-        HTTPRequest(std::string headers, ServerConfig server);
+        explicit HTTPRequest(std::pmr::memory_resource* arena = std::pmr::get_default_resource());
+        void reset();
+        headerStates scanHeader(std::string_view received);
+        void parse(std::string_view headerBlock);
+        void route(const ServerConfig& server);
+        void setHeader(std::string_view name, std::string_view value);
 };
\ No newline at end of file
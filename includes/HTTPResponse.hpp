@@ -1,8 +1,12 @@
 
 #pragma once
+#include "Buffer.hpp"
+#include "HTTPRequest.hpp"
 #include <string>
 #include <map>
+#include <memory_resource>
 #include <sstream>
+#include <sys/types.h>
 
 class HTTPResponse
 {
@@ -10,14 +14,25 @@ class HTTPResponse
         int status;
         std::string stat_msg;
     public:
-        HTTPResponse(int code = 200, const std::string& msg = "OK", std::map<int, std::string> error_pages = {{0, ""}});
-        std::map<std::string, std::string> headers;
+        // The header fields are allocated from arena, the client's request arena on the request path
+        HTTPResponse(int code = 200, const std::string& msg = "OK", const std::map<int, std::string>& error_pages = {},
+            std::pmr::memory_resource* arena = std::pmr::get_default_resource());
+        HTTPResponse(const HTTPResponse& copy);
+        HTTPResponse& operator=(const HTTPResponse& copy);
+        HTTPResponse(HTTPResponse&& other) noexcept;
+        HTTPResponse& operator=(HTTPResponse&& other) noexcept;
+        ~HTTPResponse();
+        HeaderMap headers;
         std::string body;
-        std::string toString() const;
+        // Body sent with sendfile() from fileOffset to fileEnd, the response owns fileFd
+        int fileFd;
+        off_t fileOffset;
+        off_t fileEnd;
+        void serializeHeader(Buffer& out) const;
 
         // Functions
         int getStatusCode();
         std::string getStatusMessage();
         void generateRedirectResponse(int code,const std::string& msg);
-        void generateErrorResponse(int code, const std::string& msg, std::map<int, std::string> error_pages);
+        void generateErrorResponse(int code, const std::string& msg, const std::map<int, std::string>& error_pages);
 };
\ No newline at end of file
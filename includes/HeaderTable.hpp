@@ -0,0 +1,50 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <string_view>
+#include <vector>
+
+// The header fields the server itself looks at, each has a fixed slot
+enum knownHeaders
+{
+    HEADER_HOST,
+    HEADER_CONTENT_LENGTH,
+    HEADER_CONTENT_TYPE,
+    HEADER_TRANSFER_ENCODING,
+    HEADER_CONNECTION,
+    KNOWN_HEADER_COUNT
+};
+
+#define HEADER_HASH_SLOTS 32
+
+// A field that is not one of the known ones
+struct HeaderField
+{
+    std::string_view name;
+    std::string_view value;
+};
+
+// Case-insensitive header fields: known names hash to fixed slots, others go to a flat list
+class HeaderTable
+{
+    private:
+        std::array<std::string_view, KNOWN_HEADER_COUNT> known;
+        uint32_t present;
+        std::pmr::vector<HeaderField> others;
+
+    public:
+        explicit HeaderTable(std::pmr::memory_resource* arena);
+
+        static int knownIndex(std::string_view name);
+
+        bool add(std::string_view name, std::string_view value);
+        void set(std::string_view name, std::string_view value);
+        bool has(knownHeaders header) const;
+        std::string_view get(knownHeaders header) const;
+        const std::string_view* find(std::string_view name) const;
+        std::pmr::memory_resource* resource() const;
+        void clear();
+};
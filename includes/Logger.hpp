@@ -1,6 +1,7 @@
 #pragma once
 
 #include <fstream>
+#include <mutex>
 #include <string>
 
 #define RED 	"\033[31m"
@@ -25,6 +26,8 @@ class Logger
 {
     private:
         std::ofstream logstream;
+        // Every worker thread logs through the same stream
+        std::mutex logmutex;
     public:
         Logger();
         Logger(const Logger& src) = delete;
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+// Percent of the budget that pauses readers, and the one they resume under
+#define MEMORY_HIGH_WATERMARK 90
+#define MEMORY_LOW_WATERMARK 75
+
+// Bytes held by the connection buffers of every worker, a limit of 0 turns it off
+class MemoryBudget
+{
+    private:
+        std::atomic<size_t> used;
+
+    public:
+        size_t limit;
+        size_t highWatermark;
+        size_t lowWatermark;
+
+        explicit MemoryBudget(size_t limit);
+        MemoryBudget(const MemoryBudget& copy) = delete;
+        MemoryBudget& operator=(const MemoryBudget& copy) = delete;
+
+        void charge(size_t& charged, size_t bytes);
+        size_t inUse() const;
+        bool overHigh() const;
+        bool belowLow() const;
+        bool fits(size_t bytes) const;
+};
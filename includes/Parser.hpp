@@ -7,6 +7,16 @@
 #include <vector>
 
 #define DEFAULT_MAX_BODY_SIZE 1000000 //1MB
+// Plain uploads from this size on are written to disk as they arrive
+#define DEFAULT_BODY_BUFFER_SIZE (1024 * 1024)
+#define DEFAULT_WORKERS 1
+#define MAX_WORKERS 256
+#define DEFAULT_ACCEPT_BATCH 64
+#define MAX_ACCEPT_BATCH 4096
+#define DEFAULT_EVENT_ENGINE "epoll"
+// 0 leaves the connection buffers unlimited
+#define DEFAULT_MEMORY_BUDGET 0
+#define MIN_MEMORY_BUDGET (1024 * 1024)
 #define DEBUG_LOGS false
 
 // Erilaisia redirect status koodeja ja käyttötarkoituksia
@@ -47,21 +57,33 @@ struct ServerConfig
     std::vector<std::string> server_names;
     std::map<int, std::string> error_pages;
     size_t client_max_body_size;
+    size_t client_body_buffer_size;
     std::map<std::string, Route> routes;
 };
 
+// Directives that live outside of the server blocks and apply to the whole process
+struct GlobalConfig
+{
+    int workers;
+    int acceptBatch;
+    std::string eventEngine;
+    size_t memoryBudget;
+};
+
 class Parser
 {
 
     private:
         // Variables
         std::vector<ServerConfig> server_configs;
+        GlobalConfig global_config;
         std::string extension;
         // Parsing functions
         void parseListenDirective(const std::string& line, ServerConfig& server_config);
         void parseServerNameDirective(const std::string& line, ServerConfig& server_config);
         void parseClientMaxBodySizeDirective(const std::string& line, ServerConfig& server_config);
         void parseClientMaxBodySizeDirective(const std::string& line, Route &route);
+        void parseClientBodyBufferSizeDirective(const std::string& line, ServerConfig& server_config);
         void parseErrorPageDirective(const std::string& line, ServerConfig& server_config);
         bool parseLocationDirective(std::ifstream& file, std::string& line, ServerConfig& server_config, bool serverMaxBodySizeSet);
         void parseAbsPathDirective(const std::string& line, Route& route);
@@ -73,11 +95,16 @@ class Parser
         void parseCgiExtensionDirective(const std::string& line, Route& route);
         void parseCgiExecutable(const std::string& line, Route& route);
         void parseCgiMethodsDirective(const std::string& line, Route& route);
+        void parseWorkersDirective(const std::string& line);
+        void parseAcceptBatchDirective(const std::string& line);
+        void parseEventEngineDirective(const std::string& line);
+        void parseMemoryBudgetDirective(const std::string& line);
         // Validation functions
         bool validateServerDirective(const std::string& line);
         bool validateListenDirective(const std::string& line);
         bool validateServerNameDirective(const std::string& line);
         bool validateClientMaxBodySizeDirective(const std::string& line);
+        bool validateClientBodyBufferSizeDirective(const std::string& line);
         bool validateErrorPageDirective(const std::string& line);
         bool validateLocationDirective(const std::string& line);
         bool validateAbsPathDirective(const std::string& line);
@@ -92,6 +119,10 @@ class Parser
         bool validateFile(const std::string& config_file);
         bool validateExtension(const std::string& filename, const std::string& expectedExt);
         bool validateCgiMethodsDirective(const std::string& line);
+        bool validateWorkersDirective(const std::string& line);
+        bool validateAcceptBatchDirective(const std::string& line);
+        bool validateEventEngineDirective(const std::string& line);
+        bool validateMemoryBudgetDirective(const std::string& line);
     public:
         Parser(const std::string& config_file);
         Parser(const Parser& src) = delete; // Disable copy constructor
@@ -99,6 +130,7 @@ class Parser
         ~Parser();
         bool parseConfigFile(const std::string& config_file);
         std::vector<ServerConfig> getServerConfigs();
+        GlobalConfig getGlobalConfig();
         void printServerConfigs() const;
         void printRoute(const Route& route) const;
         void printServerConfig(const ServerConfig& server_config) const;
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "EventSource.hpp"
+#include <cstdint>
+#include <vector>
+#include <sys/epoll.h>
+#include <sys/types.h>
+
+// Readiness backend of an event loop: epoll event bits in, epoll_events with data.ptr out
+class Poller
+{
+    public:
+        virtual ~Poller() {}
+        virtual int add(EventSource& source, uint32_t events) = 0;
+        virtual int remove(EventSource& source) = 0;
+        virtual int wait(std::vector<epoll_event>& events, int timeout) = 0;
+        // -1 with EAGAIN when nothing is left until the next event
+        virtual int accept(EventSource& listener) = 0;
+        virtual ssize_t receive(EventSource& source, char* buffer, size_t size) = 0;
+        virtual const char* name() const = 0;
+};
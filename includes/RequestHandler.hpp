@@ -11,10 +11,13 @@ class RequestHandler
     public:
         static HTTPResponse handleRequest(Client& client);
         static HTTPResponse handleMultipart(Client& client);
-        static bool isAllowedMethod(std::string method, Route route);
+        static bool isAllowedMethod(const std::string& method, const Route& route);
+        static bool rejectRequest(const Client& client, HTTPResponse& response);
+        static int  startUpload(Client& client);
+        static int  writeUpload(Client& client);
     private:
         static HTTPResponse handleGET(Client& client, std::string fullPath);
         static HTTPResponse handlePOST(Client& client, std::string fullPath);
-        static HTTPResponse handleDELETE(std::string fullPath, std::map<int, std::string> error_pages);
+        static HTTPResponse handleDELETE(const std::string& fullPath, const std::map<int, std::string>& error_pages);
         static HTTPResponse redirectResponse(std::string fullPath);
 };
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+
+// Byte searches with SSE2 or AVX2 on x86-64, each starts at from and returns npos when nothing is found
+size_t scanByte(std::string_view data, size_t from, char c);
+size_t scanEither(std::string_view data, size_t from, char a, char b);
+size_t scanSequence(std::string_view data, size_t from, std::string_view needle);
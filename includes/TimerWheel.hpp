@@ -0,0 +1,50 @@
+#pragma once
+
+#include "EventSource.hpp"
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#define TIMER_TICK_MS 100
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4
+
+// Intrusive list node, embedded in whatever owns the deadline
+struct TimerNode
+{
+    TimerNode* prev;
+    TimerNode* next;
+    uint64_t expiry;
+    int slot;
+    EventSource* owner;
+
+    TimerNode();
+};
+
+// Hierarchical timing wheel, far timers cascade down a level when the lower one wraps
+class TimerWheel
+{
+    private:
+        TimerNode slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+        uint64_t occupied[TIMER_WHEEL_LEVELS];
+        uint64_t currentTick;
+        size_t nTimers;
+        std::chrono::steady_clock::time_point start;
+
+        uint64_t toTick(std::chrono::steady_clock::time_point time) const;
+        void place(TimerNode& node);
+        void unlink(TimerNode& node);
+        void cascade(int level);
+
+    public:
+        TimerWheel();
+        TimerWheel(const TimerWheel& copy) = delete;
+        TimerWheel& operator=(const TimerWheel& copy) = delete;
+
+        void arm(TimerNode& node, std::chrono::steady_clock::time_point now, std::chrono::milliseconds delay);
+        void cancel(TimerNode& node);
+        bool isArmed(const TimerNode& node) const;
+        void advance(std::chrono::steady_clock::time_point now, std::vector<EventSource*>& expired);
+        int  nextTimeout(std::chrono::steady_clock::time_point now) const;
+};
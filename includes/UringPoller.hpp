@@ -0,0 +1,97 @@
+#pragma once
+
+#include "Poller.hpp"
+#include <deque>
+#include <unordered_map>
+#include <vector>
+#include <linux/io_uring.h>
+
+#define URING_ENTRIES 4096
+// A power of two
+#define URING_RECV_BUFFERS 512
+#define URING_RECV_BUFFER_SIZE 16384
+// Filled buffers one client may hold before its receive is stopped
+#define URING_RECV_QUEUE 32
+
+// io_uring backend on raw syscalls: multishot accept and recv into provided buffers, polls for the rest
+class UringPoller : public Poller
+{
+    private:
+        int ringFd;
+        void* sqRing;
+        size_t sqRingSize;
+        void* cqRing;
+        size_t cqRingSize;
+        io_uring_sqe* sqes;
+        size_t sqesSize;
+
+        unsigned* sqHead;
+        unsigned* sqTail;
+        unsigned sqMask;
+        unsigned* sqArray;
+        unsigned* cqHead;
+        unsigned* cqTail;
+        unsigned cqMask;
+        io_uring_cqe* cqes;
+        unsigned toSubmit;
+
+        io_uring_buf_ring* bufferRing;
+        char* recvBuffers;
+        unsigned short bufferTail;
+        unsigned freeBuffers;
+
+        // An accepted fd, a filled buffer, or the end of the stream (0, -errno)
+        struct Completion
+        {
+            int result;
+            unsigned short buffer;
+            size_t offset;
+        };
+        struct Registration
+        {
+            EventSource* source;
+            uint32_t events;
+            // Events harvested and not handed out yet
+            uint32_t pending;
+            bool armed;
+            bool cancelling;
+            bool ended;
+            // Accepting with accept4 since the process ran out of descriptors
+            bool direct;
+            std::deque<Completion> completed;
+        };
+        std::unordered_map<uint64_t, Registration> registered;
+        std::unordered_map<EventSource*, uint64_t> tokens;
+        uint64_t nextToken;
+        std::vector<uint64_t> rearm;
+        // Accepts and receives the kernel stopped, started again by wait()
+        std::vector<uint64_t> stopped;
+        std::vector<uint64_t> listeners;
+        std::deque<uint64_t> ready;
+
+        io_uring_sqe* getSqe();
+        int  submit();
+        int  queuePoll(uint64_t token, const Registration& registration);
+        int  queueData(uint64_t token, Registration& registration);
+        void cancelData(uint64_t token, unsigned op);
+        void recycle(unsigned short buffer);
+        void report(uint64_t token, Registration& registration, uint32_t events);
+        void complete(uint64_t token, unsigned op, const io_uring_cqe& cqe);
+        void harvest();
+        void restart();
+        Registration* find(EventSource& source);
+        void release();
+
+    public:
+        UringPoller();
+        UringPoller(const UringPoller& copy) = delete;
+        UringPoller& operator=(const UringPoller& copy) = delete;
+        ~UringPoller();
+
+        int add(EventSource& source, uint32_t events);
+        int remove(EventSource& source);
+        int wait(std::vector<epoll_event>& events, int timeout);
+        int accept(EventSource& listener);
+        ssize_t receive(EventSource& source, char* buffer, size_t size);
+        const char* name() const;
+};
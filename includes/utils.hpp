@@ -2,13 +2,17 @@
 
 #include "HTTPRequest.hpp"
 #include <string>
+#include <string_view>
 #include <vector>
 #include <filesystem>
 #include <atomic>
 #include <csignal>
 
 std::string joinPaths(std::filesystem::path path1, std::filesystem::path path2);
-bool validateHeader(HTTPRequest req);
+bool validateHeader(const HTTPRequest& req);
+bool parseContentLength(std::string_view value, size_t& length);
+bool equalsIgnoreCase(std::string_view a, std::string_view b);
+int hexValue(char c);
 void handleSignals(int signum);
 std::vector<std::string> split(const std::string& s, const std::string& s2);
 std::string extractFilename(const std::string& path, int method);
@@ -1,4 +1,6 @@
 #include "CGIHandler.hpp"
+#include "Scanner.hpp"
+#include <cerrno>
 
 CGIHandler::CGIHandler() 
 {
@@ -6,6 +8,30 @@ CGIHandler::CGIHandler()
 	writeCGIPipe[0] = -1;
 	readCGIPipe[1] = -1;
 	readCGIPipe[0] = -1;
+	childStdin.sourceType = CGI_STDIN;
+	childStdout.sourceType = CGI_STDOUT;
+	reset();
+}
+
+// The vectors and strings keep their storage, pipes still open are closed rather than leaked
+void CGIHandler::reset()
+{
+	closePipes();
+	childPid = -1;
+	fileOpen = false;
+	childStdin.fd = -1;
+	childStdin.client = nullptr;
+	childStdout.fd = -1;
+	childStdout.client = nullptr;
+	bodySent = 0;
+	envVariables.clear();
+	execArgs.clear();
+	envArray.clear();
+	execveArgs.clear();
+	fullPath.clear();
+	inputFilePath.clear();
+	output.clear();
+	tempFileName.clear();
 }
 
 int CGIHandler::getWritePipe() { return writeCGIPipe[1]; }
@@ -14,12 +40,13 @@ int CGIHandler::getReadPipe() { return readCGIPipe[0]; }
 
 int CGIHandler::getChildPid() { return childPid; }
 
-void CGIHandler::setEnvValues(HTTPRequest& request, ServerConfig server)
+void CGIHandler::setEnvValues(HTTPRequest& request, const ServerConfig& server)
 {
 	std::string server_name = server.server_names.empty() ? "localhost"
 			: server.server_names.at(0);
 	std::string localPath = joinPaths(server.routes.at(request.location).abspath, request.file);
 	fullPath = "." + localPath;
+	char absPath[PATH_MAX];
 	realpath(fullPath.c_str(), absPath);
 	envVariables.clear();
 	std::string PATH_INFO = request.pathInfo.empty() ? request.path : request.pathInfo;
@@ -34,9 +61,9 @@ void CGIHandler::setEnvValues(HTTPRequest& request, ServerConfig server)
 					"REMOTE_ADDR=" + server.host,
 					"SERVER_NAME=" + server_name,
 					"SERVER_PORT=" + server.port};
-	std::string conType =  request.headers.count("Content-Type") > 0 ? request.headers.at("Content-Type") : "text/plain";
+	std::string conType = request.headers.has(HEADER_CONTENT_TYPE) ? std::string(request.headers.get(HEADER_CONTENT_TYPE)) : "text/plain";
 	envVariables.push_back("CONTENT_TYPE=" + conType);
-	std::string conLen = request.headers.count("Content-Length") > 0 ? request.headers.at("Content-Length") : "0";
+	std::string conLen = request.headers.has(HEADER_CONTENT_LENGTH) ? std::string(request.headers.get(HEADER_CONTENT_LENGTH)) : "0";
 	envVariables.push_back("CONTENT_LENGTH=" + conLen);
 	envArray.clear();
 	for (size_t i = 0; i < envVariables.size(); i++)
@@ -49,9 +76,10 @@ void CGIHandler::setEnvValues(HTTPRequest& request, ServerConfig server)
 	execveArgs.push_back(NULL);
 }
 
-HTTPResponse CGIHandler::generateCGIResponse(std::map<int, std::string> error_pages)
+// bodySize is the full body length when output only holds the beginning of it
+HTTPResponse CGIHandler::generateCGIResponse(const std::map<int, std::string>& error_pages, size_t bodySize)
 {
-	std::string::size_type end = output.find("\r\n\r\n");
+	std::string::size_type end = scanSequence(output, 0, "\r\n\r\n");
 	if (end == std::string::npos)
 		return HTTPResponse(500, "Invalid CGI output", error_pages);
 	std::string headers = output.substr(0, end);
@@ -66,29 +94,45 @@ HTTPResponse CGIHandler::generateCGIResponse(std::map<int, std::string> error_pa
 			line.pop_back();
 		size_t colon = line.find(':');
 		if (colon != std::string::npos)
-			res.headers[line.substr(0, colon)] = line.substr(colon + 2);
+			res.headers[std::pmr::string(line.substr(0, colon))] = line.substr(colon + 2);
 	}
+	if (res.headers.count("Content-Length") == 0)
+		res.headers["Content-Length"] = std::to_string(bodySize == std::string::npos ? res.body.size() : bodySize);
 	wslog.writeToLogFile(INFO, "CGI successful", DEBUG_LOGS);
 	return res;
 }
 
-void CGIHandler::collectCGIOutput(int childReadPipeFd)
+int CGIHandler::collectCGIOutput(int childReadPipeFd)
 {
     char buffer[65536];
 
     int n = read(childReadPipeFd, buffer, sizeof(buffer));
     if (n > 0)
         output.append(buffer, n);
+    return n;
 }
 
-void CGIHandler::writeBodyToChild(HTTPRequest& request)
+void CGIHandler::closePipes()
 {
-    int written = write(writeCGIPipe[1], request.body.c_str(), request.body.size());
-    if (written > 0) 
-        request.body = request.body.substr(written);
-    if (request.body.empty() == true)
+	for (int* fd : {&writeCGIPipe[0], &writeCGIPipe[1], &readCGIPipe[0], &readCGIPipe[1]})
 	{
-        close(writeCGIPipe[1]);
-		writeCGIPipe[1] = -1;
+		if (*fd != -1)
+			close(*fd);
+		*fd = -1;
 	}
 }
+
+// Returns 1 once the whole body is in the pipe or the child stopped reading, 0 when the pipe is full
+int CGIHandler::writeBodyToChild(HTTPRequest& request)
+{
+    while (bodySent < request.body.size())
+    {
+        ssize_t written = write(writeCGIPipe[1], request.body.data() + bodySent, request.body.size() - bodySent);
+        if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return 0;
+        if (written <= 0)
+            return 1;
+        bodySent += written;
+    }
+    return 1;
+}
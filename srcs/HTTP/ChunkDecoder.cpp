@@ -0,0 +1,156 @@
+#include "ChunkDecoder.hpp"
+#include "HTTPRequest.hpp"
+#include "Scanner.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cstdint>
+
+ChunkDecoder::ChunkDecoder()
+{
+    reset();
+}
+
+void ChunkDecoder::reset()
+{
+    state = CHUNK_SIZE;
+    chunkSize = 0;
+    digits = 0;
+    remaining = 0;
+    lineLength = 0;
+    trailerLength = 0;
+    bodySize = 0;
+}
+
+// Includes what the current chunk still announces, so the limit applies once the size is read
+size_t ChunkDecoder::expected() const
+{
+    if (remaining > SIZE_MAX - bodySize)
+        return SIZE_MAX;
+    return bodySize + remaining;
+}
+
+void ChunkDecoder::fail()
+{
+    state = CHUNK_ERROR;
+}
+
+void ChunkDecoder::step(char c)
+{
+    switch (state)
+    {
+        case CHUNK_SIZE:
+            if (hexValue(c) != -1)
+            {
+                if (chunkSize > (SIZE_MAX >> 4))
+                    return fail();
+                chunkSize = chunkSize * 16 + hexValue(c);
+                digits++;
+            }
+            else if (digits == 0)
+                fail();
+            else if (c == ' ' || c == '\t')
+                state = CHUNK_SIZE_SPACE;
+            else if (c == ';')
+                state = CHUNK_EXTENSION;
+            else if (c == '\r')
+                state = CHUNK_SIZE_LF;
+            else
+                fail();
+            return ;
+        case CHUNK_SIZE_SPACE:
+            if (c == ';')
+                state = CHUNK_EXTENSION;
+            else if (c == '\r')
+                state = CHUNK_SIZE_LF;
+            else if (c != ' ' && c != '\t')
+                fail();
+            return ;
+        case CHUNK_EXTENSION:
+            if (c == '\r')
+                state = CHUNK_SIZE_LF;
+            else if (c == '\n' || ++lineLength > MAX_CHUNK_LINE)
+                fail();
+            return ;
+        case CHUNK_SIZE_LF:
+            if (c != '\n')
+                return fail();
+            lineLength = 0;
+            remaining = chunkSize;
+            state = chunkSize == 0 ? CHUNK_TRAILER_START : CHUNK_DATA;
+            return ;
+        case CHUNK_DATA_CR:
+            state = c == '\r' ? CHUNK_DATA_LF : CHUNK_ERROR;
+            return ;
+        case CHUNK_DATA_LF:
+            if (c != '\n')
+                return fail();
+            chunkSize = 0;
+            digits = 0;
+            state = CHUNK_SIZE;
+            return ;
+        case CHUNK_TRAILER_START:
+            if (c == '\r')
+                state = CHUNK_END_LF;
+            else if (c == '\n')
+                fail();
+            else
+            {
+                lineLength = 1;
+                state = CHUNK_TRAILER;
+            }
+            return ;
+        case CHUNK_TRAILER:
+            if (c == '\r')
+            {
+                trailerLength += lineLength;
+                state = trailerLength > DEFAULT_MAX_HEADER_SIZE ? CHUNK_ERROR : CHUNK_TRAILER_LF;
+            }
+            else if (c == '\n' || ++lineLength > MAX_CHUNK_LINE)
+                fail();
+            return ;
+        case CHUNK_TRAILER_LF:
+            state = c == '\n' ? CHUNK_TRAILER_START : CHUNK_ERROR;
+            return ;
+        case CHUNK_END_LF:
+            state = c == '\n' ? CHUNK_DONE : CHUNK_ERROR;
+            return ;
+        default:
+            return ;
+    }
+}
+
+// Uses input up to the end of the next run of body bytes set in data, the caller passes the rest again
+size_t ChunkDecoder::decode(std::string_view input, std::string_view& data)
+{
+    data = std::string_view();
+    size_t pos = 0;
+    while (pos < input.size() && state != CHUNK_DONE && state != CHUNK_ERROR)
+    {
+        if (state == CHUNK_DATA)
+        {
+            size_t take = std::min(remaining, input.size() - pos);
+            data = input.substr(pos, take);
+            remaining -= take;
+            bodySize += take;
+            if (remaining == 0)
+                state = CHUNK_DATA_CR;
+            return pos + take;
+        }
+        // Extensions and trailers are skipped up to their line end at once
+        if (state == CHUNK_EXTENSION || state == CHUNK_TRAILER)
+        {
+            size_t end = scanEither(input, pos, '\r', '\n');
+            if (end == std::string_view::npos)
+                end = input.size();
+            lineLength += end - pos;
+            pos = end;
+            if (lineLength > MAX_CHUNK_LINE)
+                fail();
+            if (pos == input.size() || state == CHUNK_ERROR)
+                break ;
+        }
+        step(input[pos++]);
+    }
+    return pos;
+}
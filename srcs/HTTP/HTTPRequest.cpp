@@ -1,51 +1,53 @@
 #include "HTTPRequest.hpp"
 #include "Logger.hpp"
-#include <sstream>
+#include "Scanner.hpp"
+#include "utils.hpp"
 #include <iostream>
 #include <algorithm>
 #include <filesystem>
+#include <string_view>
+#include <cctype>
+#include <cstring>
+#include <unistd.h>
 
-HTTPRequest::HTTPRequest() 
+HTTPRequest::HTTPRequest(std::pmr::memory_resource* arena) : fields(arena), headers(arena)
 {
-    method = "";
-    path = "";
-    version = "";
-    file = "";
-    eMethod = INVALID;
-    pathInfo = "";
-    isCGI = false;
-    fileUsed = false;
-    fileIsOpen = false;
-    validHostName = true;
-    multipart = false;
-    fileFd = -1;
-    body = "";
-    tempFileName = "";
-    query = "";
-    location = "";
-    multipart = false;
+    uploadFd = -1;
+    reset();
 }
 
-HTTPRequest::HTTPRequest(std::string headers, ServerConfig server)
+// The strings keep their storage, the arena is released after this
+void HTTPRequest::reset()
 {
-    method = "";
-    path = "";
-    version = "";
-    file = "";
+    method.clear();
+    path.clear();
+    version.clear();
+    file.clear();
     eMethod = INVALID;
-    pathInfo = "";
+    pathInfo.clear();
     isCGI = false;
     fileUsed = false;
     fileIsOpen = false;
     validHostName = true;
     multipart = false;
     fileFd = -1;
-    query = "";
-    body = "";
-    tempFileName = "";
-    location = "";
-    multipart = false;
-    parser(headers, server);
+    if (uploadFd != -1)
+        close(uploadFd);
+    uploadFd = -1;
+    uploadSize = 0;
+    uploadWritten = 0;
+    query.clear();
+    body.clear();
+    tempFileName.clear();
+    location.clear();
+    headers.clear();
+    std::pmr::vector<FieldSpan>(fields.get_allocator()).swap(fields);
+    headerState = HEADER_REQUEST_LINE;
+    headerLength = 0;
+    lineStart = 0;
+    scanned = 0;
+    requestLineLength = 0;
+    malformed = false;
 }
 
 reqTypes getMethodEnum(const std::string& method)
@@ -56,85 +58,182 @@ reqTypes getMethodEnum(const std::string& method)
     return INVALID;
 }
 
-static std::string hexToAscii(std::string str)
+// Length of the escape at pos, 0 when it is not '%' and two hex digits
+static size_t escapeAt(std::string_view target, size_t pos, char& byte)
 {
-    std::stringstream ss(str);
-    int value;
-    ss >> std::hex >> value;
-    return std::string(1, static_cast<char>(value));
+    if (pos + 2 >= target.size())
+        return 0;
+    int high = hexValue(target[pos + 1]);
+    int low = hexValue(target[pos + 2]);
+    if (high == -1 || low == -1)
+        return 0;
+    byte = static_cast<char>(high * 16 + low);
+    return 3;
 }
 
-static void decode(std::string& raw)
+// Decodes %XX escapes in place in one pass, false for a broken escape or a NUL byte
+static bool percentDecode(std::string& target)
 {
-    for (size_t i = 0; i < raw.size(); i++)
+    size_t write = scanByte(target, 0, '%');
+    if (write == std::string::npos)
+        return true;
+    size_t read = write;
+    while (read < target.size())
     {
-        if (raw[i] == '%')
+        if (target[read] == '%')
         {
-            std::string temp = raw.substr(i + 1,  2);
-            raw.erase(i, 3);
-            temp = hexToAscii(temp);
-            raw.insert(i, temp);
+            char byte;
+            if (escapeAt(target, read, byte) == 0 || byte == '\0')
+                return false;
+            target[write++] = byte;
+            read += 3;
+            continue ;
         }
+        size_t next = scanByte(target, read, '%');
+        if (next == std::string::npos)
+            next = target.size();
+        std::memmove(&target[write], &target[read], next - read);
+        write += next - read;
+        read = next;
     }
+    target.resize(write);
+    return true;
 }
 
-void HTTPRequest::parser(std::string raw, ServerConfig server)
+// The query goes to a CGI as it came, encoded, its escapes are only checked
+static bool validEscapes(std::string_view query)
 {
-    isCGI = false;
-    decode(raw);
-    std::istringstream stream(raw);
-    std::string line;
-    if (!std::getline(stream, line))
-        return ;
-    if (line.back() == '\r')
-        line.pop_back();
-    std::istringstream request_line(line);
-    request_line >> method >> path >> version;
-    eMethod = getMethodEnum(method);
-    if (path.back() != '/')
+    char byte;
+    for (size_t pos = scanByte(query, 0, '%'); pos != std::string_view::npos; pos = scanByte(query, pos + 3, '%'))
     {
-        std::string test_location = path + "/";
-        if (server.routes.find(test_location) != server.routes.end())
-            path += '/';
-        else
-            file = path.substr(path.find_last_of("/") + 1);
+        if (escapeAt(query, pos, byte) == 0)
+            return false;
     }
-    while (std::getline(stream, line))
+    return true;
+}
+
+// Next whitespace separated word of the request line
+static std::string_view nextWord(std::string_view line, size_t& pos)
+{
+    while (pos < line.size() && std::isspace(static_cast<unsigned char>(line[pos])))
+        pos++;
+    size_t start = pos;
+    while (pos < line.size() && !std::isspace(static_cast<unsigned char>(line[pos])))
+        pos++;
+    return line.substr(start, pos - start);
+}
+
+// Optional whitespace, what may surround a field value
+static bool isOWS(char c)
+{
+    return (c == ' ' || c == '\t');
+}
+
+// A line without a name or with whitespace before the colon makes the request malformed
+void HTTPRequest::addField(std::string_view line, size_t start)
+{
+    size_t colon = scanByte(line, 0, ':');
+    if (colon == std::string_view::npos || colon == 0 || scanEither(line, 0, ' ', '\t') < colon)
     {
-        if (line.back() == '\r')
-            line.pop_back();
-        if (line.empty())
-            break;
-        size_t colon = line.find(':');
-        if (colon != std::string::npos)
-        {
-            std::string key = line.substr(0, colon);
-            std::string value = line.substr(colon + 1);
-            key.erase(std::remove_if(key.begin(), key.end(), [](char c){ return (c == ' ' || c == '\n' || c == '\r' ||
-                c == '\t' || c == '\v' || c == '\f');}), key.end());
+        malformed = true;
+        return ;
+    }
+    size_t value = colon + 1;
+    size_t valueEnd = line.size();
+    while (value < valueEnd && isOWS(line[value]))
+        value++;
+    while (valueEnd > value && isOWS(line[valueEnd - 1]))
+        valueEnd--;
+    fields.push_back(FieldSpan{start, colon, start + value, valueEnd - value});
+}
 
-            value.erase(std::remove_if(value.begin(), value.end(), [](char c){ return (c == ' ' || c == '\n' || c == '\r' ||
-                    c == '\t' || c == '\v' || c == '\f');}), value.end());
-            auto result = headers.insert({key, value});
-            if (result.second == false)
-            {
-                key = "Duplicate";
-                value = "Key";
-                headers.insert({key, value});
-            }
+// Carries on where the previous call stopped, the lines are kept as offsets as the buffer may move
+headerStates HTTPRequest::scanHeader(std::string_view received)
+{
+    while (headerState == HEADER_REQUEST_LINE || headerState == HEADER_FIELDS)
+    {
+        size_t end = scanByte(received, scanned, '\n');
+        if (end == std::string_view::npos)
+        {
+            scanned = received.size();
+            if (received.size() > DEFAULT_MAX_HEADER_SIZE)
+                headerState = HEADER_TOO_LARGE;
+            break ;
         }
-        else
+        if (end >= DEFAULT_MAX_HEADER_SIZE)
+        {
+            headerState = HEADER_TOO_LARGE;
+            break ;
+        }
+        size_t start = lineStart;
+        std::string_view line = received.substr(start, end - start);
+        if (!line.empty() && line.back() == '\r')
+            line.remove_suffix(1);
+        lineStart = end + 1;
+        scanned = end + 1;
+        if (headerState == HEADER_REQUEST_LINE)
+        {
+            requestLineLength = line.size();
+            headerState = HEADER_FIELDS;
+        }
+        else if (line.empty())
         {
-            std::string key = "Invalid";
-            std::string value = "Format";
-            headers.insert({key, value});
+            headerLength = lineStart;
+            headerState = HEADER_COMPLETE;
         }
+        else
+            addField(line, start);
+    }
+    return headerState;
+}
+
+// The names and values point into headerBlock, which has to stay until the request is reset
+void HTTPRequest::parse(std::string_view headerBlock)
+{
+    std::string_view line = headerBlock.substr(0, requestLineLength);
+    size_t word = 0;
+    method = nextWord(line, word);
+    std::string_view target = nextWord(line, word);
+    version = nextWord(line, word);
+    eMethod = getMethodEnum(method);
+    size_t queryStart = scanByte(target, 0, '?');
+    if (queryStart != std::string_view::npos)
+    {
+        query = target.substr(queryStart + 1);
+        target = target.substr(0, queryStart);
     }
-    size_t query_pos = path.find('?');
-    if (query_pos != std::string::npos)
+    path = target;
+    if (percentDecode(path) == false || validEscapes(query) == false)
+        malformed = true;
+    for (const FieldSpan& field : fields)
     {
-        query = path.substr(query_pos + 1);
-        path = path.substr(0, query_pos);
+        std::string_view name = headerBlock.substr(field.name, field.nameLength);
+        std::string_view value = headerBlock.substr(field.value, field.valueLength);
+        if (headers.add(name, value) == false)
+            malformed = true;
+    }
+}
+
+// Copied to the arena as there is no header block to point into
+void HTTPRequest::setHeader(std::string_view name, std::string_view value)
+{
+    std::pmr::memory_resource* arena = headers.resource();
+    char* bytes = static_cast<char*>(arena->allocate(name.size() + value.size() + 1, 1));
+    std::memcpy(bytes, name.data(), name.size());
+    std::memcpy(bytes + name.size(), value.data(), value.size());
+    headers.set(std::string_view(bytes, name.size()), std::string_view(bytes + name.size(), value.size()));
+}
+
+void HTTPRequest::route(const ServerConfig& server)
+{
+    isCGI = false;
+    if (!path.empty() && path.back() != '/')
+    {
+        std::string test_location = path + "/";
+        if (server.routes.find(test_location) != server.routes.end())
+            path += '/';
+        else
+            file = path.substr(path.find_last_of("/") + 1);
     }
     int pos1 = path.find_first_of("/");
     int pos2 = path.find_last_of("/");
@@ -151,13 +250,10 @@ void HTTPRequest::parser(std::string raw, ServerConfig server)
             file = path.substr(0 + location.size());
         }
     }
-    if (headers.find("Content-Type") != headers.end())
+    if (headers.get(HEADER_CONTENT_TYPE).find("multipart/form-data") != std::string_view::npos)
     {
-        if (headers.at("Content-Type").find("multipart/form-data") != std::string::npos)
-        {
-            fileUsed = true;
-            multipart = true;
-        }
+        fileUsed = true;
+        multipart = true;
     }
     if (server.routes.find(location) != server.routes.end())
     {
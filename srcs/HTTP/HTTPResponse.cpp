@@ -4,23 +4,94 @@
 #include <fstream>
 #include <iostream>
 #include "Logger.hpp"
+#include <unistd.h>
+#include <utility>
+#include <charconv>
+#include <string_view>
 
-HTTPResponse::HTTPResponse(int code, const std::string& msg, std::map<int, std::string> error_pages) : status(code), stat_msg(msg)
+HTTPResponse::HTTPResponse(int code, const std::string& msg, const std::map<int, std::string>& error_pages,
+    std::pmr::memory_resource* arena) : status(code), stat_msg(msg), headers(arena)
 {
+    fileFd = -1;
+    fileOffset = 0;
+    fileEnd = 0;
     if (code >= 300 && code <= 308) generateRedirectResponse(code, msg);
     if (code >= 400) generateErrorResponse(code, msg, error_pages);
 }
 
-std::string HTTPResponse::toString() const
+HTTPResponse::HTTPResponse(const HTTPResponse& copy)
 {
-    std::ostringstream response;
-    response << "HTTP/1.1 " << status << " " << stat_msg << "\r\n";
-    for (std::map<std::string, std::string>::const_iterator it = headers.begin(); it != headers.end(); ++it)
-        response << it->first << ": " << it->second << "\r\n";
-    response << "\r\n";
-    if (!body.empty())
-        response << body;
-    return response.str();
+    fileFd = -1;
+    *this = copy;
+}
+
+// A copy gets a descriptor of its own, so each one can close it
+HTTPResponse& HTTPResponse::operator=(const HTTPResponse& copy)
+{
+    if (this != &copy)
+    {
+        status = copy.status;
+        stat_msg = copy.stat_msg;
+        headers = copy.headers;
+        body = copy.body;
+        if (fileFd != -1)
+            close(fileFd);
+        fileFd = copy.fileFd == -1 ? -1 : dup(copy.fileFd);
+        fileOffset = copy.fileOffset;
+        fileEnd = copy.fileEnd;
+    }
+    return *this;
+}
+
+HTTPResponse::HTTPResponse(HTTPResponse&& other) noexcept
+    : status(other.status), stat_msg(std::move(other.stat_msg)), headers(std::move(other.headers)), body(std::move(other.body))
+{
+    fileFd = std::exchange(other.fileFd, -1);
+    fileOffset = other.fileOffset;
+    fileEnd = other.fileEnd;
+}
+
+HTTPResponse& HTTPResponse::operator=(HTTPResponse&& other) noexcept
+{
+    if (this != &other)
+    {
+        status = other.status;
+        stat_msg = std::move(other.stat_msg);
+        headers = std::move(other.headers);
+        body = std::move(other.body);
+        if (fileFd != -1)
+            close(fileFd);
+        fileFd = std::exchange(other.fileFd, -1);
+        fileOffset = other.fileOffset;
+        fileEnd = other.fileEnd;
+    }
+    return *this;
+}
+
+HTTPResponse::~HTTPResponse()
+{
+    if (fileFd != -1)
+        close(fileFd);
+}
+
+// Status line and headers, the body is sent from where it is
+void HTTPResponse::serializeHeader(Buffer& out) const
+{
+    char code[16];
+    std::to_chars_result result = std::to_chars(code, code + sizeof(code), status);
+    out.append("HTTP/1.1 ");
+    out.append(std::string_view(code, result.ptr - code));
+    out.append(" ");
+    out.append(stat_msg);
+    out.append("\r\n");
+    for (HeaderMap::const_iterator it = headers.begin(); it != headers.end(); ++it)
+    {
+        out.append(it->first);
+        out.append(": ");
+        out.append(it->second);
+        out.append("\r\n");
+    }
+    out.append("\r\n");
 }
 
 int HTTPResponse::getStatusCode()
@@ -49,11 +120,12 @@ void HTTPResponse::generateRedirectResponse(int code, const std::string& newLoca
     headers["Content-Length"] = std::to_string(body.size());
 }
 
-void HTTPResponse::generateErrorResponse(int code, const std::string& msg, std::map<int, std::string> error_pages)
+void HTTPResponse::generateErrorResponse(int code, const std::string& msg, const std::map<int, std::string>& error_pages)
 {
-        if (error_pages.find(code) != error_pages.end())
+        auto page = error_pages.find(code);
+        if (page != error_pages.end())
         {
-            std::string filepath = "." + error_pages[code];
+            std::string filepath = "." + page->second;
             std::ifstream file(filepath);
             if (file.is_open())
             {
@@ -0,0 +1,138 @@
+#include "HeaderTable.hpp"
+#include "utils.hpp"
+
+static constexpr std::string_view knownNames[KNOWN_HEADER_COUNT] = {
+    "host",
+    "content-length",
+    "content-type",
+    "transfer-encoding",
+    "connection"
+};
+
+static constexpr char toLower(char c)
+{
+    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+// Length, first and last letter are enough to tell the known names apart
+static constexpr size_t headerHash(std::string_view name)
+{
+    if (name.empty())
+        return 0;
+    return (name.size() * 3 + toLower(name.front()) + toLower(name.back())) % HEADER_HASH_SLOTS;
+}
+
+static constexpr std::array<int8_t, HEADER_HASH_SLOTS> buildSlots()
+{
+    std::array<int8_t, HEADER_HASH_SLOTS> slots{};
+    for (int8_t& slot : slots)
+        slot = -1;
+    for (int i = 0; i < KNOWN_HEADER_COUNT; i++)
+        slots[headerHash(knownNames[i])] = i;
+    return slots;
+}
+
+static constexpr std::array<int8_t, HEADER_HASH_SLOTS> slots = buildSlots();
+
+static constexpr bool slotsArePerfect()
+{
+    for (int i = 0; i < KNOWN_HEADER_COUNT; i++)
+    {
+        if (slots[headerHash(knownNames[i])] != i)
+            return false;
+    }
+    return true;
+}
+
+static_assert(slotsArePerfect(), "two known header names share a hash slot");
+
+HeaderTable::HeaderTable(std::pmr::memory_resource* arena) : others(arena)
+{
+    present = 0;
+}
+
+// Slot of a known header name in any case, -1 for any other name
+int HeaderTable::knownIndex(std::string_view name)
+{
+    int index = slots[headerHash(name)];
+    if (index == -1 || equalsIgnoreCase(name, knownNames[index]) == false)
+        return -1;
+    return index;
+}
+
+// Adds a field unless one with the same name is already there
+bool HeaderTable::add(std::string_view name, std::string_view value)
+{
+    int index = knownIndex(name);
+    if (index != -1)
+    {
+        if (present & (1u << index))
+            return false;
+        present |= 1u << index;
+        known[index] = value;
+        return true;
+    }
+    if (find(name) != nullptr)
+        return false;
+    others.push_back(HeaderField{name, value});
+    return true;
+}
+
+void HeaderTable::set(std::string_view name, std::string_view value)
+{
+    int index = knownIndex(name);
+    if (index != -1)
+    {
+        present |= 1u << index;
+        known[index] = value;
+        return ;
+    }
+    for (HeaderField& field : others)
+    {
+        if (equalsIgnoreCase(field.name, name))
+        {
+            field.value = value;
+            return ;
+        }
+    }
+    others.push_back(HeaderField{name, value});
+}
+
+bool HeaderTable::has(knownHeaders header) const
+{
+    return (present & (1u << header)) != 0;
+}
+
+// The value of a known field, empty when the request has none
+std::string_view HeaderTable::get(knownHeaders header) const
+{
+    if (has(header) == false)
+        return std::string_view();
+    return known[header];
+}
+
+// The value of any field, nullptr when the request has none
+const std::string_view* HeaderTable::find(std::string_view name) const
+{
+    int index = knownIndex(name);
+    if (index != -1)
+        return has(static_cast<knownHeaders>(index)) ? &known[index] : nullptr;
+    for (const HeaderField& field : others)
+    {
+        if (equalsIgnoreCase(field.name, name))
+            return &field.value;
+    }
+    return nullptr;
+}
+
+std::pmr::memory_resource* HeaderTable::resource() const
+{
+    return others.get_allocator().resource();
+}
+
+// Gives the list's storage back as well, the arena is released after this
+void HeaderTable::clear()
+{
+    present = 0;
+    std::pmr::vector<HeaderField>(others.get_allocator()).swap(others);
+}
@@ -14,6 +14,7 @@
 #include <iostream>
 #include <filesystem>
 #include <dirent.h>
+#include <algorithm>
 
 static std::string getMimeType(const std::string& ext)
 {
@@ -72,13 +73,38 @@ HTTPResponse generateSuccessResponse(std::string body, std::string type)
     return response;
 }
 
+// The response keeps the file open and sends it with sendfile()
+static int openRegularFile(const std::string& path, struct stat& info)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+    if (fstat(fd, &info) == -1 || !S_ISREG(info.st_mode))
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static HTTPResponse generateFileResponse(int fd, off_t size, const std::string& type, Client& client)
+{
+    HTTPResponse response(200, "OK", client.serverInfo->error_pages, &client.arena);
+    response.fileFd = fd;
+    response.fileOffset = 0;
+    response.fileEnd = size;
+    response.headers["Content-Type"] = type;
+    response.headers["Content-Length"] = std::to_string(size);
+    return response;
+}
+
 static HTTPResponse generateIndexListing(std::string fullPath, std::string location, Client &client)
 {
     DIR* dir = opendir(fullPath.c_str());
     if (!dir)
     {
         wslog.writeToLogFile(ERROR, "500 Failed to open directory", DEBUG_LOGS);
-        return HTTPResponse(500, "Failed to open directory", client.serverInfo.error_pages);
+        return HTTPResponse(500, "Failed to open directory", client.serverInfo->error_pages);
     }
     std::stringstream html;
     html << "<html><head><title>" << location << "</title></head><body>\n";
@@ -108,7 +134,9 @@ static HTTPResponse generateIndexListing(std::string fullPath, std::string locat
             displayedName += "/";
         }
         char time[64];
-        std::strftime(time, sizeof(time), "%Y-%m-%d %H:%M", std::localtime(&st.st_mtime));
+        struct tm modified;
+        localtime_r(&st.st_mtime, &modified);
+        std::strftime(time, sizeof(time), "%Y-%m-%d %H:%M", &modified);
         std::string size = (S_ISDIR(st.st_mode)) ? "-" : std::to_string(st.st_size) + " B";
         html << "<tr><td><a href=\"" << ref << "\">" << displayedName << "</a></td>"
              << "<td>" << time << "</td>"
@@ -122,18 +150,12 @@ static HTTPResponse generateIndexListing(std::string fullPath, std::string locat
 
 HTTPResponse RequestHandler::handleMultipart(Client& client)
 {
-    if (client.request.headers.count("Content-Type") == 0)
+    if (client.request.headers.has(HEADER_CONTENT_TYPE) == false)
     {
         wslog.writeToLogFile(ERROR, "400 Missing Content-Type", DEBUG_LOGS);
-        return HTTPResponse(400, "Missing Content-Type", client.serverInfo.error_pages);
-    }
-    auto its = client.request.headers.find("Content-Type");
-    std::string ct = its->second;
-    if (its == client.request.headers.end())
-    {
-        wslog.writeToLogFile(ERROR, "400 Invalid headers", DEBUG_LOGS);
-        return HTTPResponse(400, "Invalid headers", client.serverInfo.error_pages);
+        return HTTPResponse(400, "Missing Content-Type", client.serverInfo->error_pages);
     }
+    std::string ct(client.request.headers.get(HEADER_CONTENT_TYPE));
     std::string boundary;
     std::string::size_type pos = ct.find("boundary=");
     if (pos == std::string::npos)
@@ -156,9 +178,9 @@ HTTPResponse RequestHandler::handleMultipart(Client& client)
         if (file.empty())
             continue;
         std::string content = extractContent(part);
-        if (client.serverInfo.routes.find(client.request.location) != client.serverInfo.routes.end())
+        if (client.serverInfo->routes.find(client.request.location) != client.serverInfo->routes.end())
         {
-            std::string folder = client.serverInfo.routes.at(client.request.location).abspath;
+            std::string folder = client.serverInfo->routes.at(client.request.location).abspath;
             std::string path = folder;
             if (path.back() != '/')
                 path += "/";
@@ -168,7 +190,7 @@ HTTPResponse RequestHandler::handleMultipart(Client& client)
             if (!out.is_open())
             {
                 wslog.writeToLogFile(ERROR, "500 Failed to open file for writing", DEBUG_LOGS);
-                return HTTPResponse(500, "Failed to open file for writing", client.serverInfo.error_pages);
+                return HTTPResponse(500, "Failed to open file for writing", client.serverInfo->error_pages);
             }
             out.write(content.c_str(), content.size());
             out.close();
@@ -176,46 +198,131 @@ HTTPResponse RequestHandler::handleMultipart(Client& client)
         else
         {
             wslog.writeToLogFile(ERROR, "500 Location not found multipart", DEBUG_LOGS);
-            return HTTPResponse(500, "Location not found", client.serverInfo.error_pages);
+            return HTTPResponse(500, "Location not found", client.serverInfo->error_pages);
         }
 
     }
     if (lastPath.empty() || access(lastPath.c_str(), R_OK) != 0)
     {
         wslog.writeToLogFile(ERROR, "400 File not uploaded", DEBUG_LOGS);
-        return HTTPResponse(400, "File not uploaded", client.serverInfo.error_pages);
+        return HTTPResponse(400, "File not uploaded", client.serverInfo->error_pages);
     }
     std::string ext = getFileExtension(client.request.path);
     wslog.writeToLogFile(INFO, "POST (multi) File(s) uploaded successfully", DEBUG_LOGS);
     return generateSuccessResponse("File(s) uploaded successfully\n", getMimeType(ext));
 }
 
+// Large plain uploads go to an unnamed file allocated up front, 1 when the body goes there
+int RequestHandler::startUpload(Client& client)
+{
+    HTTPRequest& request = client.request;
+    if (request.eMethod != POST || request.isCGI || request.multipart || request.file.empty())
+        return 0;
+    if (request.headers.has(HEADER_TRANSFER_ENCODING) || request.headers.has(HEADER_CONTENT_TYPE) == false)
+        return 0;
+    auto route = client.serverInfo->routes.find(request.location);
+    if (request.headers.has(HEADER_CONTENT_LENGTH) == false || route == client.serverInfo->routes.end())
+        return 0;
+    size_t length;
+    if (parseContentLength(request.headers.get(HEADER_CONTENT_LENGTH), length) == false || length < client.serverInfo->client_body_buffer_size || length > route->second.client_max_body_size)
+        return 0;
+    std::string fullPath = "." + joinPaths(route->second.abspath, request.file);
+    std::string directory = std::filesystem::path(fullPath).parent_path().string();
+    int fd = open(directory.c_str(), O_TMPFILE | O_WRONLY | O_CLOEXEC, 0666);
+    if (fd == -1)
+    {
+        wslog.writeToLogFile(INFO, "No unnamed file for the upload in " + directory + ", reading it into memory", DEBUG_LOGS);
+        return 0;
+    }
+    if (fallocate(fd, 0, 0, length) == -1 && errno != EOPNOTSUPP)
+    {
+        close(fd);
+        wslog.writeToLogFile(ERROR, "500 No space for the upload", DEBUG_LOGS);
+        return -500;
+    }
+    request.uploadFd = fd;
+    request.uploadSize = length;
+    request.uploadWritten = 0;
+    return 1;
+}
+
+// Returns 1 once the whole body is in the file, 0 while more is to come
+int RequestHandler::writeUpload(Client& client)
+{
+    HTTPRequest& request = client.request;
+    while (client.rawReadData.empty() == false && request.uploadWritten < request.uploadSize)
+    {
+        size_t bytes = std::min(client.rawReadData.size(), request.uploadSize - request.uploadWritten);
+        ssize_t written = write(request.uploadFd, client.rawReadData.data(), bytes);
+        if (written == -1 && errno == EINTR)
+            continue ;
+        if (written <= 0)
+        {
+            wslog.writeToLogFile(ERROR, "500 Writing the upload failed", DEBUG_LOGS);
+            return -500;
+        }
+        client.rawReadData.consume(written);
+        request.uploadWritten += written;
+    }
+    return request.uploadWritten == request.uploadSize ? 1 : 0;
+}
+
+// linkat() does not replace an existing name, so link next to it and rename over it.
+// A replaced file keeps its mode, a new one gets 0666 less the umask like open().
+static bool commitUpload(int fd, const std::string& fullPath)
+{
+    struct stat existing;
+    if (stat(fullPath.c_str(), &existing) == 0 && fchmod(fd, existing.st_mode & 07777) == -1)
+        return false;
+    std::string procPath = "/proc/self/fd/" + std::to_string(fd);
+    std::string partPath = fullPath + ".part" + std::to_string(fd);
+    if (linkat(AT_FDCWD, procPath.c_str(), AT_FDCWD, partPath.c_str(), AT_SYMLINK_FOLLOW) == -1)
+        return false;
+    if (rename(partPath.c_str(), fullPath.c_str()) == -1)
+    {
+        unlink(partPath.c_str());
+        return false;
+    }
+    return true;
+}
+
 HTTPResponse RequestHandler::handlePOST(Client& client, std::string fullPath)
 {
-    if (client.request.headers.count("Content-Type") == 0)
+    if (client.request.headers.has(HEADER_CONTENT_TYPE) == false)
     {
         wslog.writeToLogFile(ERROR, "400 Missing Content-Type", DEBUG_LOGS);
-        return HTTPResponse(400, "Missing Content-Type", client.serverInfo.error_pages);
+        return HTTPResponse(400, "Missing Content-Type", client.serverInfo->error_pages);
     }
-    if (client.request.headers["Content-Type"].find("multipart/form-data") != std::string::npos)
+    if (client.request.headers.get(HEADER_CONTENT_TYPE).find("multipart/form-data") != std::string_view::npos)
         return handleMultipart(client);
-    std::ofstream out(fullPath.c_str(), std::ios::binary);
-    if (!out.is_open())
+    if (client.request.uploadFd != -1)
+    {
+        if (commitUpload(client.request.uploadFd, fullPath) == false)
+        {
+            wslog.writeToLogFile(ERROR, "500 Failed to store the upload", DEBUG_LOGS);
+            return HTTPResponse(500, "Failed to store the upload", client.serverInfo->error_pages);
+        }
+    }
+    else
     {
-        wslog.writeToLogFile(ERROR, "500 Failed to open file for writing", DEBUG_LOGS);
-        return HTTPResponse(500, "Failed to open file for writing", client.serverInfo.error_pages);
+        std::ofstream out(fullPath.c_str(), std::ios::binary);
+        if (!out.is_open())
+        {
+            wslog.writeToLogFile(ERROR, "500 Failed to open file for writing", DEBUG_LOGS);
+            return HTTPResponse(500, "Failed to open file for writing", client.serverInfo->error_pages);
+        }
+        out.write(client.request.body.c_str(), client.request.body.size());
+        out.close();
     }
-    out.write(client.request.body.c_str(), client.request.body.size());
-    out.close();
     if (access(fullPath.c_str(), R_OK) != 0)
     {
         wslog.writeToLogFile(ERROR, "400 File not uploaded", DEBUG_LOGS);
-        return HTTPResponse(400, "File not uploaded", client.serverInfo.error_pages);
+        return HTTPResponse(400, "File not uploaded", client.serverInfo->error_pages);
     }
     if (client.request.file.empty())
     {
         wslog.writeToLogFile(ERROR, "400 Bad request", DEBUG_LOGS);
-        return HTTPResponse(400, "Bad request", client.serverInfo.error_pages);
+        return HTTPResponse(400, "Bad request", client.serverInfo->error_pages);
     }
     std::string ext = getFileExtension(client.request.path);
     wslog.writeToLogFile(INFO, "POST File(s) uploaded successfully", DEBUG_LOGS);
@@ -228,30 +335,27 @@ HTTPResponse RequestHandler::handleGET(Client& client, std::string fullPath)
     if (stat(fullPath.c_str(), &s) != 0 || access(fullPath.c_str(), R_OK) != 0)
     {
         wslog.writeToLogFile(ERROR, "404 Not Found", DEBUG_LOGS);
-        return HTTPResponse(404, "Not Found", client.serverInfo.error_pages);
+        return HTTPResponse(404, "Not Found", client.serverInfo->error_pages);
     }
     bool isDir = S_ISDIR(s.st_mode);
     if (isDir == true)
     {
-        if (!client.serverInfo.routes.at(client.request.location).index_file.empty())
+        if (!client.serverInfo->routes.at(client.request.location).index_file.empty())
         {
-            fullPath = joinPaths(fullPath, client.serverInfo.routes.at(client.request.location).index_file);
-            std::ifstream file(fullPath.c_str(), std::ios::binary);
-            if (!file.is_open())
+            fullPath = joinPaths(fullPath, client.serverInfo->routes.at(client.request.location).index_file);
+            int fd = openRegularFile(fullPath, s);
+            if (fd == -1)
             {
                 wslog.writeToLogFile(ERROR, "404, Not Found", false);
                 return HTTPResponse(404, "Not Found");
             }
-            std::ostringstream content;
-            content << file.rdbuf();
-            file.close();
             std::string ext = getFileExtension(fullPath);
             wslog.writeToLogFile(INFO, "GET File(s) downloaded successfully", false);
-            return generateSuccessResponse(content.str(), getMimeType(ext));
+            return generateFileResponse(fd, s.st_size, getMimeType(ext), client);
         }
         else
         {
-            if (client.serverInfo.routes.at(client.request.location).autoindex)
+            if (client.serverInfo->routes.at(client.request.location).autoindex)
                 return generateIndexListing(fullPath, client.request.location, client);
             else
             {
@@ -260,21 +364,18 @@ HTTPResponse RequestHandler::handleGET(Client& client, std::string fullPath)
             }
         }
     }
-    std::ifstream file(fullPath.c_str(), std::ios::binary);
-    if (!file.is_open())
+    int fd = openRegularFile(fullPath, s);
+    if (fd == -1)
     {
         wslog.writeToLogFile(ERROR, "500 Internal Server Error", DEBUG_LOGS);
-        return HTTPResponse(500, "Internal Server Error", client.serverInfo.error_pages);
+        return HTTPResponse(500, "Internal Server Error", client.serverInfo->error_pages);
     }
-    std::ostringstream content;
-    content << file.rdbuf();
-    file.close();
     std::string ext = getFileExtension(fullPath);
     wslog.writeToLogFile(INFO, "GET File(s) downloaded successfully", DEBUG_LOGS);
-    return generateSuccessResponse(content.str(), getMimeType(ext));
+    return generateFileResponse(fd, s.st_size, getMimeType(ext), client);
 }
 
-HTTPResponse RequestHandler::handleDELETE(std::string fullPath, std::map<int, std::string> error_pages)
+HTTPResponse RequestHandler::handleDELETE(const std::string& fullPath, const std::map<int, std::string>& error_pages)
 {
     if (access(fullPath.c_str(), F_OK) != 0)
         return HTTPResponse(404, "Not Found", error_pages);
@@ -285,7 +386,7 @@ HTTPResponse RequestHandler::handleDELETE(std::string fullPath, std::map<int, st
 }
 
 
-bool RequestHandler::isAllowedMethod(std::string method, Route route)
+bool RequestHandler::isAllowedMethod(const std::string& method, const Route& route)
 {
     for (size_t i = 0; i < route.accepted_methods.size(); i++)
     {
@@ -303,19 +404,38 @@ HTTPResponse RequestHandler::redirectResponse(std::string fullPath)
     return res;
 }
 
-HTTPResponse RequestHandler::handleRequest(Client& client)
+// Refusals that only depend on the request line, also checked before the body is read
+bool RequestHandler::rejectRequest(const Client& client, HTTPResponse& response)
 {
     for (size_t i = 0; i < client.request.file.size(); i++)
     {
         if (std::isspace(client.request.file[i]))
-            return HTTPResponse(403, "Whitespace in filename", client.serverInfo.error_pages);
+        {
+            response = HTTPResponse(403, "Whitespace in filename", client.serverInfo->error_pages);
+            return true;
+        }
     }
     if (client.request.path.find("..") != std::string::npos)
     {
         wslog.writeToLogFile(ERROR, "403 Forbidden", DEBUG_LOGS);
-        return HTTPResponse(403, "Forbidden", client.serverInfo.error_pages);
+        response = HTTPResponse(403, "Forbidden", client.serverInfo->error_pages);
+        return true;
+    }
+    if (!isAllowedMethod(client.request.method, client.serverInfo->routes.at(client.request.location)))
+    {
+        response = HTTPResponse(405, "Method not allowed", client.serverInfo->error_pages);
+        return true;
     }
-    std::string fullPath = "." + joinPaths(client.serverInfo.routes[client.request.location].abspath, client.request.file);
+    return false;
+}
+
+HTTPResponse RequestHandler::handleRequest(Client& client)
+{
+    AllocScope routing(client.allocStats, PHASE_ROUTE);
+    HTTPResponse rejected;
+    if (rejectRequest(client, rejected))
+        return rejected;
+    std::string fullPath = "." + joinPaths(client.serverInfo->routes.at(client.request.location).abspath, client.request.file);
     bool validFile = false;
     try
     {
@@ -324,17 +444,16 @@ HTTPResponse RequestHandler::handleRequest(Client& client)
     catch(const std::exception& e)
     {
         wslog.writeToLogFile(ERROR, "Invalid file name", DEBUG_LOGS);
-        return HTTPResponse(404, "Invalid file name", client.serverInfo.error_pages);
+        return HTTPResponse(404, "Invalid file name", client.serverInfo->error_pages);
     }
     if (!validFile)
     {
         wslog.writeToLogFile(ERROR, "Invalid file", DEBUG_LOGS);
-        return HTTPResponse(404, "Invalid file", client.serverInfo.error_pages);
+        return HTTPResponse(404, "Invalid file", client.serverInfo->error_pages);
     }
     if (fullPath != "." && std::filesystem::is_regular_file(fullPath) == false && std::filesystem::is_directory(fullPath) && fullPath.back() != '/')
         return redirectResponse(client.request.file);
-    if (!isAllowedMethod(client.request.method, client.serverInfo.routes[client.request.location]))
-        return HTTPResponse(405, "Method not allowed", client.serverInfo.error_pages);
+    AllocScope handling(client.allocStats, PHASE_HANDLER);
     switch (client.request.eMethod)
     {
         case GET:
@@ -342,8 +461,8 @@ HTTPResponse RequestHandler::handleRequest(Client& client)
         case POST:
             return handlePOST(client, fullPath);
         case DELETE:
-            return handleDELETE(fullPath, client.serverInfo.error_pages);
+            return handleDELETE(fullPath, client.serverInfo->error_pages);
         default:
-            return HTTPResponse(501, "Not Implemented", client.serverInfo.error_pages);
+            return HTTPResponse(501, "Not Implemented", client.serverInfo->error_pages);
     }
 }
\ No newline at end of file
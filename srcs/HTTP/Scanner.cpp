@@ -0,0 +1,152 @@
+#include "Scanner.hpp"
+
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define SCANNER_SIMD
+#endif
+
+static size_t scalarEither(const char* data, size_t from, size_t size, char a, char b)
+{
+    for (size_t i = from; i < size; i++)
+    {
+        if (data[i] == a || data[i] == b)
+            return i;
+    }
+    return std::string_view::npos;
+}
+
+// Only positions where the first and last byte of the needle match are compared in full
+static bool matchesAt(const char* data, size_t pos, std::string_view needle)
+{
+    return std::memcmp(data + pos + 1, needle.data() + 1, needle.size() - 2) == 0;
+}
+
+#ifdef SCANNER_SIMD
+
+__attribute__((target("avx2")))
+static size_t avx2Either(const char* data, size_t from, size_t size, char a, char b)
+{
+    const __m256i first = _mm256_set1_epi8(a);
+    const __m256i second = _mm256_set1_epi8(b);
+    size_t i = from;
+    for (; i + 32 <= size; i += 32)
+    {
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        __m256i hits = _mm256_or_si256(_mm256_cmpeq_epi8(block, first), _mm256_cmpeq_epi8(block, second));
+        unsigned mask = _mm256_movemask_epi8(hits);
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+    return scalarEither(data, i, size, a, b);
+}
+
+static size_t sse2Either(const char* data, size_t from, size_t size, char a, char b)
+{
+    const __m128i first = _mm_set1_epi8(a);
+    const __m128i second = _mm_set1_epi8(b);
+    size_t i = from;
+    for (; i + 16 <= size; i += 16)
+    {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        __m128i hits = _mm_or_si128(_mm_cmpeq_epi8(block, first), _mm_cmpeq_epi8(block, second));
+        unsigned mask = _mm_movemask_epi8(hits);
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+    return scalarEither(data, i, size, a, b);
+}
+
+__attribute__((target("avx2")))
+static size_t avx2Sequence(const char* data, size_t from, size_t size, std::string_view needle)
+{
+    const size_t last = needle.size() - 1;
+    const __m256i first = _mm256_set1_epi8(needle.front());
+    const __m256i ending = _mm256_set1_epi8(needle.back());
+    size_t i = from;
+    for (; i + last + 32 <= size; i += 32)
+    {
+        __m256i start = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        __m256i end = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + last));
+        unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(start, first), _mm256_cmpeq_epi8(end, ending)));
+        while (mask != 0)
+        {
+            size_t pos = i + __builtin_ctz(mask);
+            if (matchesAt(data, pos, needle))
+                return pos;
+            mask &= mask - 1;
+        }
+    }
+    return std::string_view(data, size).find(needle, i);
+}
+
+static size_t sse2Sequence(const char* data, size_t from, size_t size, std::string_view needle)
+{
+    const size_t last = needle.size() - 1;
+    const __m128i first = _mm_set1_epi8(needle.front());
+    const __m128i ending = _mm_set1_epi8(needle.back());
+    size_t i = from;
+    for (; i + last + 16 <= size; i += 16)
+    {
+        __m128i start = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        __m128i end = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + last));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(start, first), _mm_cmpeq_epi8(end, ending)));
+        while (mask != 0)
+        {
+            size_t pos = i + __builtin_ctz(mask);
+            if (matchesAt(data, pos, needle))
+                return pos;
+            mask &= mask - 1;
+        }
+    }
+    return std::string_view(data, size).find(needle, i);
+}
+
+// Decided once, the first time a search runs
+static bool hasAVX2()
+{
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+}
+
+#endif
+
+size_t scanEither(std::string_view data, size_t from, char a, char b)
+{
+    if (from >= data.size())
+        return std::string_view::npos;
+#ifdef SCANNER_SIMD
+    if (hasAVX2())
+        return avx2Either(data.data(), from, data.size(), a, b);
+    return sse2Either(data.data(), from, data.size(), a, b);
+#else
+    return scalarEither(data.data(), from, data.size(), a, b);
+#endif
+}
+
+size_t scanByte(std::string_view data, size_t from, char c)
+{
+    return scanEither(data, from, c, c);
+}
+
+size_t scanSequence(std::string_view data, size_t from, std::string_view needle)
+{
+    if (needle.size() < 2)
+        return needle.empty() ? data.find(needle, from) : scanByte(data, from, needle.front());
+    if (from >= data.size())
+        return std::string_view::npos;
+#ifdef SCANNER_SIMD
+    if (hasAVX2())
+        return avx2Sequence(data.data(), from, data.size(), needle);
+    return sse2Sequence(data.data(), from, data.size(), needle);
+#else
+    for (size_t pos = scanByte(data, from, needle.front()); pos != std::string_view::npos && pos + needle.size() <= data.size();
+        pos = scanByte(data, pos + 1, needle.front()))
+    {
+        if (data[pos + needle.size() - 1] == needle.back() && matchesAt(data.data(), pos, needle))
+            return pos;
+    }
+    return std::string_view::npos;
+#endif
+}
@@ -4,11 +4,16 @@
 #include <stack>
 #include <filesystem>
 #include <iostream>
+#include <thread>
 
 
 Parser::Parser(const std::string& config_file)
 {
     extension = ".conf";
+    global_config.workers = DEFAULT_WORKERS;
+    global_config.acceptBatch = DEFAULT_ACCEPT_BATCH;
+    global_config.eventEngine = DEFAULT_EVENT_ENGINE;
+    global_config.memoryBudget = DEFAULT_MEMORY_BUDGET;
     if (!parseConfigFile(config_file))
     {
         throw std::runtime_error("Failed to parse config file: " + config_file);
@@ -84,6 +89,27 @@ void Parser::parseClientMaxBodySizeDirective(const std::string& line, ServerConf
     }
 }
 
+void Parser::parseClientBodyBufferSizeDirective(const std::string& line, ServerConfig& server_config)
+{
+    size_t pos = line.find("client_body_buffer_size ") + 24; // Skip "client_body_buffer_size "
+    size_t end_pos = line.find(";", pos);
+    std::string size_str = line.substr(pos, end_pos - pos);
+    if (size_str.find("K") != std::string::npos)
+    {
+        size_str.erase(size_str.find("K"));
+        server_config.client_body_buffer_size = std::stoul(size_str) * 1024; // Convert to bytes
+    }
+    else if (size_str.find("M") != std::string::npos)
+    {
+        size_str.erase(size_str.find("M"));
+        server_config.client_body_buffer_size = std::stoul(size_str) * 1024 * 1024; // Convert to bytes
+    }
+    else
+    {
+        server_config.client_body_buffer_size = std::stoul(size_str); // Assume bytes
+    }
+}
+
 void Parser::parseClientMaxBodySizeDirective(const std::string& line, Route& route)
 {
     // Extract client_max_body_size from the line
@@ -210,6 +236,61 @@ void Parser::parseCgiExecutable(const std::string&line, Route& route)
     route.cgiexecutable = line.substr(pos, end_pos - pos);
 }
 
+void Parser::parseWorkersDirective(const std::string& line)
+{
+    size_t pos = line.find("workers ") + 8; // Skip "workers "
+    size_t end_pos = line.find(";");
+    std::string value = line.substr(pos, end_pos - pos);
+    if (value == "auto")
+    {
+        // One event loop per core, hardware_concurrency() may return 0 if it cannot tell
+        global_config.workers = std::thread::hardware_concurrency();
+        if (global_config.workers == 0)
+            global_config.workers = DEFAULT_WORKERS;
+        if (global_config.workers > MAX_WORKERS)
+            global_config.workers = MAX_WORKERS;
+    }
+    else
+        global_config.workers = std::stoi(value);
+    if (global_config.workers < 1 || global_config.workers > MAX_WORKERS)
+        throw std::out_of_range("workers must be between 1 and " + std::to_string(MAX_WORKERS));
+}
+
+void Parser::parseAcceptBatchDirective(const std::string& line)
+{
+    size_t pos = line.find("accept_batch ") + 13; // Skip "accept_batch "
+    size_t end_pos = line.find(";");
+    global_config.acceptBatch = std::stoi(line.substr(pos, end_pos - pos));
+    if (global_config.acceptBatch < 1 || global_config.acceptBatch > MAX_ACCEPT_BATCH)
+        throw std::out_of_range("accept_batch must be between 1 and " + std::to_string(MAX_ACCEPT_BATCH));
+}
+
+void Parser::parseEventEngineDirective(const std::string& line)
+{
+    size_t pos = line.find("event_engine ") + 13; // Skip "event_engine "
+    size_t end_pos = line.find(";");
+    global_config.eventEngine = line.substr(pos, end_pos - pos);
+}
+
+void Parser::parseMemoryBudgetDirective(const std::string& line)
+{
+    size_t pos = line.find("memory_budget ") + 14; // Skip "memory_budget "
+    size_t end_pos = line.find(";");
+    std::string size_str = line.substr(pos, end_pos - pos);
+    size_t unit = 1;
+    if (size_str.back() == 'K')
+        unit = 1024;
+    else if (size_str.back() == 'M')
+        unit = 1024 * 1024;
+    else if (size_str.back() == 'G')
+        unit = 1024 * 1024 * 1024;
+    if (unit != 1)
+        size_str.pop_back();
+    global_config.memoryBudget = std::stoul(size_str) * unit;
+    if (global_config.memoryBudget < MIN_MEMORY_BUDGET)
+        throw std::out_of_range("memory_budget must be at least " + std::to_string(MIN_MEMORY_BUDGET) + " bytes");
+}
+
 bool Parser::parseLocationDirective(std::ifstream& file, std::string& line, ServerConfig& server_config, bool serverMaxBodySizeSet)
 {
     std::unordered_set<std::string> foundkeys;
@@ -397,6 +478,15 @@ bool Parser::validateServerNameDirective(const std::string& line)
         return false;
 }
 
+bool Parser::validateClientBodyBufferSizeDirective(const std::string& line)
+{
+    std::regex client_body_buffer_size_regex(R"(^\s*client_body_buffer_size\s+\d+[KM]?;$)");
+    if (std::regex_match(line, client_body_buffer_size_regex))
+        return true;
+    else
+        return false;
+}
+
 bool Parser::validateClientMaxBodySizeDirective(const std::string& line)
 {
     std::regex client_max_body_size_regex(R"(^\s*client_max_body_size\s+\d+[KM]?;$)");
@@ -507,6 +597,42 @@ bool Parser::validateCgiExtensionDirective(const std::string& line)
         return false;
 }
 
+bool Parser::validateWorkersDirective(const std::string& line)
+{
+    std::regex workers_regex(R"(^\s*workers\s+(\d{1,3}|auto);$)");
+    if (std::regex_match(line, workers_regex))
+        return true;
+    else
+        return false;
+}
+
+bool Parser::validateAcceptBatchDirective(const std::string& line)
+{
+    std::regex accept_batch_regex(R"(^\s*accept_batch\s+\d{1,4};$)");
+    if (std::regex_match(line, accept_batch_regex))
+        return true;
+    else
+        return false;
+}
+
+bool Parser::validateEventEngineDirective(const std::string& line)
+{
+    std::regex event_engine_regex(R"(^\s*event_engine\s+(epoll|io_uring);$)");
+    if (std::regex_match(line, event_engine_regex))
+        return true;
+    else
+        return false;
+}
+
+bool Parser::validateMemoryBudgetDirective(const std::string& line)
+{
+    std::regex memory_budget_regex(R"(^\s*memory_budget\s+\d{1,9}[KMG]?;$)");
+    if (std::regex_match(line, memory_budget_regex))
+        return true;
+    else
+        return false;
+}
+
 bool Parser::validateBrackets(const std::string& config_file)
 {
     std::ifstream file(config_file);
@@ -553,10 +679,11 @@ bool Parser::validateDirectives(const std::string& line)
         return true;
     // Check if the line contains any of the directives
     if (validateServerDirective(line) || validateListenDirective(line) || validateServerNameDirective(line) ||
-        validateClientMaxBodySizeDirective(line) || validateErrorPageDirective(line) || validateLocationDirective(line) ||
+        validateClientMaxBodySizeDirective(line) || validateClientBodyBufferSizeDirective(line) || validateErrorPageDirective(line) || validateLocationDirective(line) ||
         validateAbsPathDirective(line) || validateIndexDirective(line) || validateAutoIndexDirective(line) ||
         validateAllowMethodsDirective(line) || validateCgiMethodsDirective(line) || validateReturnDirective(line) || validateUploadPathDirective(line) ||
-        validateCgiExtensionDirective(line))
+        validateCgiExtensionDirective(line) || validateWorkersDirective(line) || validateAcceptBatchDirective(line) ||
+        validateEventEngineDirective(line) || validateMemoryBudgetDirective(line))
     {
         return true;
     }
@@ -631,10 +758,31 @@ bool Parser::parseConfigFile(const std::string& config_file)
         trimLeadingAndTrailingSpaces(line);
         if (line.empty() || line.at(0) == '#')
             continue;
+        if (line.find("workers ") != std::string::npos)
+        {
+            parseWorkersDirective(line);
+            continue;
+        }
+        if (line.find("accept_batch ") != std::string::npos)
+        {
+            parseAcceptBatchDirective(line);
+            continue;
+        }
+        if (line.find("event_engine ") != std::string::npos)
+        {
+            parseEventEngineDirective(line);
+            continue;
+        }
+        if (line.find("memory_budget ") != std::string::npos)
+        {
+            parseMemoryBudgetDirective(line);
+            continue;
+        }
         if (line.find("server {") != std::string::npos)
         {
             bool maxBodySizeSet = false;
             ServerConfig server_config{};
+            server_config.client_body_buffer_size = DEFAULT_BODY_BUFFER_SIZE;
             while (getline(file, line) && line.find("}") == std::string::npos)
             {
                 trimLeadingAndTrailingSpaces(line);
@@ -662,6 +810,10 @@ bool Parser::parseConfigFile(const std::string& config_file)
                     parseClientMaxBodySizeDirective(line, server_config);
                     maxBodySizeSet = true;
                 }
+                else if (line.find("client_body_buffer_size ") != std::string::npos)
+                {
+                    parseClientBodyBufferSizeDirective(line, server_config);
+                }
             }
             if (maxBodySizeSet == false)
                 server_config.client_max_body_size = DEFAULT_MAX_BODY_SIZE;
@@ -677,6 +829,11 @@ std::vector<ServerConfig> Parser::getServerConfigs()
     return server_configs;
 }
 
+GlobalConfig Parser::getGlobalConfig()
+{
+    return global_config;
+}
+
 ServerConfig Parser::getServerConfig(std::string servername)
 {
     for (auto i: server_configs)
@@ -724,6 +881,7 @@ void Parser::printServerConfig(const ServerConfig& server_config) const
     }
     std::cout << std::endl;
     std::cout << "Client Max Body Size: " << server_config.client_max_body_size << std::endl;
+    std::cout << "Client Body Buffer Size: " << server_config.client_body_buffer_size << std::endl;
     for (const auto& route : server_config.routes)
     {
         printRoute(route.second);
@@ -732,6 +890,10 @@ void Parser::printServerConfig(const ServerConfig& server_config) const
 
 void Parser::printServerConfigs() const
 {
+    std::cout << "Workers: " << global_config.workers << std::endl;
+    std::cout << "Accept batch: " << global_config.acceptBatch << std::endl;
+    std::cout << "Event engine: " << global_config.eventEngine << std::endl;
+    std::cout << "Memory budget: " << global_config.memoryBudget << std::endl;
     for (const auto& server_config : server_configs)
     {
         printServerConfig(server_config);
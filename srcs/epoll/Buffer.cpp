@@ -0,0 +1,169 @@
+#include "Buffer.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+Buffer::Buffer(std::pmr::memory_resource* resource) : resource(resource)
+{
+    storage = nullptr;
+    capacity = 0;
+    readPos = 0;
+    writePos = 0;
+}
+
+Buffer::Buffer(const Buffer& copy) : resource(copy.resource)
+{
+    storage = nullptr;
+    capacity = 0;
+    readPos = 0;
+    writePos = 0;
+    append(copy.view());
+}
+
+Buffer& Buffer::operator=(const Buffer& copy)
+{
+    if (this != &copy)
+        assign(copy.view());
+    return *this;
+}
+
+Buffer::Buffer(Buffer&& other) noexcept : resource(other.resource)
+{
+    storage = std::exchange(other.storage, nullptr);
+    capacity = std::exchange(other.capacity, 0);
+    readPos = std::exchange(other.readPos, 0);
+    writePos = std::exchange(other.writePos, 0);
+}
+
+Buffer& Buffer::operator=(Buffer&& other) noexcept
+{
+    if (this != &other)
+    {
+        release();
+        resource = other.resource;
+        storage = std::exchange(other.storage, nullptr);
+        capacity = std::exchange(other.capacity, 0);
+        readPos = std::exchange(other.readPos, 0);
+        writePos = std::exchange(other.writePos, 0);
+    }
+    return *this;
+}
+
+Buffer::~Buffer()
+{
+    release();
+}
+
+// Slides the live bytes down when the space in front pays for the move, reallocates otherwise
+void Buffer::makeRoom(size_t bytes)
+{
+    if (capacity - writePos >= bytes)
+        return ;
+    size_t used = size();
+    if (readPos >= used && capacity - used >= bytes)
+    {
+        std::memmove(storage, storage + readPos, used);
+        readPos = 0;
+        writePos = used;
+        return ;
+    }
+    size_t newCapacity = std::max(capacity * 2, used + bytes);
+    char* grown = static_cast<char*>(resource->allocate(newCapacity));
+    if (used > 0)
+        std::memcpy(grown, storage + readPos, used);
+    if (storage != nullptr)
+        resource->deallocate(storage, capacity);
+    storage = grown;
+    capacity = newCapacity;
+    readPos = 0;
+    writePos = used;
+}
+
+size_t Buffer::size() const
+{
+    return writePos - readPos;
+}
+
+size_t Buffer::reserved() const
+{
+    return capacity;
+}
+
+bool Buffer::empty() const
+{
+    return writePos == readPos;
+}
+
+const char* Buffer::data() const
+{
+    return storage + readPos;
+}
+
+std::string_view Buffer::view() const
+{
+    if (capacity == 0)
+        return std::string_view();
+    return std::string_view(storage + readPos, size());
+}
+
+// Filled by the caller and made part of the buffer with commit()
+char* Buffer::prepare(size_t bytes)
+{
+    makeRoom(bytes);
+    return storage + writePos;
+}
+
+void Buffer::commit(size_t bytes)
+{
+    writePos += std::min(bytes, capacity - writePos);
+}
+
+void Buffer::append(std::string_view bytes)
+{
+    if (bytes.empty())
+        return ;
+    std::memcpy(prepare(bytes.size()), bytes.data(), bytes.size());
+    writePos += bytes.size();
+}
+
+void Buffer::assign(std::string_view bytes)
+{
+    clear();
+    append(bytes);
+}
+
+void Buffer::reserve(size_t bytes)
+{
+    if (bytes > size())
+        makeRoom(bytes - size());
+}
+
+void Buffer::consume(size_t bytes)
+{
+    readPos += std::min(bytes, size());
+    if (readPos == writePos)
+        clear();
+}
+
+void Buffer::truncate(size_t bytes)
+{
+    if (bytes < size())
+        writePos = readPos + bytes;
+}
+
+void Buffer::clear()
+{
+    readPos = 0;
+    writePos = 0;
+}
+
+void Buffer::release()
+{
+    if (storage != nullptr)
+        resource->deallocate(storage, capacity);
+    storage = nullptr;
+    capacity = 0;
+    readPos = 0;
+    writePos = 0;
+}
@@ -0,0 +1,50 @@
+#include "EpollPoller.hpp"
+
+#include <stdexcept>
+#include <sys/socket.h>
+#include <unistd.h>
+
+EpollPoller::EpollPoller()
+{
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd < 0)
+        throw std::runtime_error("Creating epoll failed");
+}
+
+EpollPoller::~EpollPoller()
+{
+    close(epollFd);
+}
+
+int EpollPoller::add(EventSource& source, uint32_t events)
+{
+    struct epoll_event setup { };
+    setup.data.ptr = &source;
+    setup.events = events;
+    return epoll_ctl(epollFd, EPOLL_CTL_ADD, source.fd, &setup);
+}
+
+int EpollPoller::remove(EventSource& source)
+{
+    return epoll_ctl(epollFd, EPOLL_CTL_DEL, source.fd, nullptr);
+}
+
+int EpollPoller::wait(std::vector<epoll_event>& events, int timeout)
+{
+    return epoll_wait(epollFd, events.data(), events.size(), timeout);
+}
+
+int EpollPoller::accept(EventSource& listener)
+{
+    return accept4(listener.fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+}
+
+ssize_t EpollPoller::receive(EventSource& source, char* buffer, size_t size)
+{
+    return recv(source.fd, buffer, size, MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+
+const char* EpollPoller::name() const
+{
+    return "epoll";
+}
@@ -1,5 +1,8 @@
 #include "EventLoop.hpp"
 #include "RequestHandler.hpp"
+#include "Scanner.hpp"
+#include "EpollPoller.hpp"
+#include "UringPoller.hpp"
 #include <iostream>
 #include <unistd.h>
 #include <fcntl.h>
@@ -10,81 +13,112 @@
 #include <sstream>
 #include <algorithm>
 #include <netdb.h>
+#include <netinet/in.h>
 #include <sys/types.h>
 #include <sys/socket.h>
-#include <sys/timerfd.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
 #include <cstdlib>
 
-static int initServerSocket(ServerConfig server)
+static int initServerSocket(const ServerConfig& server, bool reusePort)
 {
-    int serverSocket = socket(AF_INET, (SOCK_STREAM | SOCK_NONBLOCK), 0);
+    int serverSocket = socket(AF_INET, (SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC), 0);
     if (serverSocket == -1)
         return -1;
     int opt = 1;
     setsockopt(serverSocket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    // Each worker binds its own socket and the kernel spreads connections between them
+    if (reusePort && setsockopt(serverSocket, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) == -1)
+    {
+        close(serverSocket);
+        return -1;
+    }
     struct addrinfo hints, *res;
     memset(&hints, 0, sizeof(hints));
     hints.ai_family = AF_INET;
     hints.ai_socktype = SOCK_STREAM;
     int status = getaddrinfo(server.host.c_str(), server.port.c_str(), &hints, &res);
     if (status != 0)
+    {
+        close(serverSocket);
         return -1;
+    }
     int rvalue = bind(serverSocket, res->ai_addr, res->ai_addrlen);
     freeaddrinfo(res);
     if (rvalue == -1)
+    {
+        close(serverSocket);
         return -1;
+    }
     rvalue = listen(serverSocket, SOMAXCONN);
     if (rvalue == -1)
+    {
+        close(serverSocket);
         return -1;
+    }
     return (serverSocket);
 }
 
-static void toggleEpollEvents(int fd, int loop, uint32_t events)
+static std::unique_ptr<Poller> createPoller(const std::string& engine, int id)
 {
-    struct epoll_event ev {};
-    ev.data.fd = fd;
-    ev.events = events;
-    if (epoll_ctl(loop, EPOLL_CTL_MOD, fd, &ev) < 0)
-        throw std::runtime_error("epoll_ctl MOD failed " + std::to_string(errno));
+    if (engine == "io_uring")
+    {
+        try {
+            return std::make_unique<UringPoller>();
+        }
+        catch (const std::runtime_error& e)
+        {
+            wslog.writeToLogFile(ERROR, "Worker " + std::to_string(id) + ": " + e.what() + ", falling back to epoll", true);
+        }
+    }
+    return std::make_unique<EpollPoller>();
 }
 
-EventLoop::EventLoop(std::vector<ServerConfig> serverConfigs) : eventLog(MAX_CONNECTIONS), timerValues { }
+EventLoop::EventLoop(const std::vector<ServerConfig>& serverConfigs, const GlobalConfig& globalConfig, MemoryBudget& memoryBudget, int workerId)
+    : memoryBudget(memoryBudget), bufferPool(std::pmr::pool_options{0, BUFFER_POOL_LARGEST_BLOCK}), eventLog(MAX_CONNECTIONS)
 {
-    signal(SIGPIPE, handleSignals);
-    signal(SIGINT, handleSignals);
-    struct epoll_event setup {};
-    nChildren = 0;
-    loop = epoll_create1(0);
-    if (loop < 0)
-        throw std::runtime_error("Creating epoll failed");
+    nClients = 0;
+    id = workerId;
+    this->globalConfig = globalConfig;
+    poller = createPoller(globalConfig.eventEngine, id);
+    wakeup.sourceType = WAKEUP;
+    wakeup.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeup.fd < 0)
+        throw std::runtime_error("Creating wakeup eventfd failed");
+    if (poller->add(wakeup, EPOLLIN) < 0)
+        throw std::runtime_error("wakeup eventfd poller ADD failed");
     for (size_t i = 0; i < serverConfigs.size(); i++)
     {
         try {
             bool hostFound = false;
-            for (auto ite = this->servers.begin(); ite != this->servers.end(); ite++)
+            for (auto& listener : listeners)
             {
-                ServerConfig server = ite->second.at(0);
+                const ServerConfig& server = *listener->serverConfigs.at(0);
                 if (serverConfigs.at(i).host == server.host && serverConfigs.at(i).port == server.port)
                 {
-                    ite->second.push_back(serverConfigs.at(i));
+                    listener->serverConfigs.push_back(&serverConfigs.at(i));
                     hostFound = true;
                     break ;
                 }
             }
             if (hostFound == false)
             {
-                serverSocket = initServerSocket(serverConfigs[i]);
+                int serverSocket = initServerSocket(serverConfigs[i], globalConfig.workers > 1);
                 if (serverSocket == -1)
                     throw std::runtime_error("server setup failed");
-                serverConfigs[i].fd = serverSocket;
-                setup.data.fd = serverConfigs[i].fd;
-                setup.events = EPOLLIN;
-                if (epoll_ctl(loop, EPOLL_CTL_ADD, serverSocket, &setup) < 0)
-                    throw std::runtime_error("serverSocket epoll_ctl ADD failed");
-                servers[serverSocket].push_back(serverConfigs[i]);
-                wslog.writeToLogFile(INFO, "Created a server with FD" + std::to_string(serverSocket), true);
+                std::unique_ptr<Listener> listener = std::make_unique<Listener>();
+                listener->sourceType = LISTENER;
+                listener->fd = serverSocket;
+                listener->serverConfigs.push_back(&serverConfigs[i]);
+                if (poller->add(*listener, EPOLLIN) < 0)
+                    throw std::runtime_error("serverSocket poller ADD failed");
+                listeners.push_back(std::move(listener));
+                wslog.writeToLogFile(INFO, "Worker " + std::to_string(id) + " created a server with FD" + std::to_string(serverSocket), true);
             }
         }
         catch (const std::bad_alloc& e)
@@ -97,299 +131,610 @@ EventLoop::EventLoop(std::vector<ServerConfig> serverConfigs) : eventLog(MAX_CON
 
 void EventLoop::closeFds()
 {
-    close(loop);
-    for (auto& server : servers)
-        close(server.first);
+    close(wakeup.fd);
+    for (auto& listener : listeners)
+        close(listener->fd);
     for (auto& client : clients)
-        close(client.first);
-    wslog.~Logger();
+    {
+        if (client)
+            close(client->fd);
+    }
 }
 
 EventLoop::~EventLoop() 
 {
+    // An io_uring poller holds its own references to the listeners until the ring
+    // is torn down, shut them down so the port stops taking connections right away
+    for (auto& listener : listeners)
+        shutdown(listener->fd, SHUT_RDWR);
     closeFds();
 }
 
-static void handleErrorMessages(std::string errorMessage, std::map<int, Client>& clients, int newFd)
+static Client* findOldestClient(std::vector<std::unique_ptr<Client>>& clients)
+{
+    Client* oldestClient = nullptr;
+    std::chrono::steady_clock::time_point oldestTimestamp = std::chrono::steady_clock::time_point::max();
+
+    for (auto& client : clients)
+    {
+        if (client && client->timestamp < oldestTimestamp)
+        {
+            oldestClient = client.get();
+            oldestTimestamp = client->timestamp;
+        }
+    }
+    return oldestClient;
+}
+
+void EventLoop::addClient(Listener& listener, int fd)
 {
-    if (errorMessage == "oldFd epoll_ctl DEL failed")
-        throw std::runtime_error("oldFd epoll_ctl DEL failed, closing the server");
-    else if (errorMessage == "Client insert failed or duplicate fd" || errorMessage == "Accepting new client failed")
-        wslog.writeToLogFile(ERROR, "Accepting a new client failed, continuing without connecting the client", DEBUG_LOGS);
-    else if (errorMessage == "newClient epoll_ctl ADD failed")
+    try {
+        std::unique_ptr<Client> newClient;
+        if (freeClients.empty() == false)
+        {
+            newClient = std::move(freeClients.back());
+            freeClients.pop_back();
+            newClient->attach(fd, listener.serverConfigs);
+        }
+        else
+            newClient = std::make_unique<Client>(fd, listener.serverConfigs, &bufferPool);
+        if (static_cast<size_t>(fd) >= clients.size())
+            clients.resize(fd + 1);
+        if (poller->add(*newClient, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET) < 0)
+        {
+            memoryBudget.charge(newClient->charged, 0);
+            close(fd);
+            wslog.writeToLogFile(INFO, "Client closed and removed, after failing to add FD into the poller, continuing", DEBUG_LOGS);
+            return ;
+        }
+        newClient->timestamp = now;
+        setDeadline(*newClient, HEADER_DEADLINE);
+        clients[fd] = std::move(newClient);
+        nClients++;
+        wslog.writeToLogFile(INFO, "Connecting a new client FD" + std::to_string(fd), true);
+    }
+    catch (const std::bad_alloc& e)
     {
-        close(clients.at(newFd).fd);
-        clients.erase(clients.at(newFd).fd);
-        for (auto&  client : clients)
-            wslog.writeToLogFile(INFO, "client FD" + std::to_string(client.second.fd)+  " is here", DEBUG_LOGS);
-        wslog.writeToLogFile(INFO, "Client closed and removed, after failing to add FD into epoll, continuing", DEBUG_LOGS);
+        close(fd);
+        wslog.writeToLogFile(ERROR, "Failed to add a client into the client table due to bad alloc, continuing without connecting the client", DEBUG_LOGS);
+    }
+}
+
+void EventLoop::acceptClient(Listener& listener)
+{
+    // The listener is level-triggered, what is left past the batch is reported again
+    for (int accepted = 0; accepted < globalConfig.acceptBatch; accepted++)
+    {
+        int fd = poller->accept(listener);
+        if (fd < 0 && errno == EMFILE)
+        {
+            Client* oldest = findOldestClient(clients);
+            if (oldest != nullptr)
+            {
+                wslog.writeToLogFile(INFO, "---CLOSING CLIENT FD" + std::to_string(oldest->fd) + " PREMATURELY!---", DEBUG_LOGS);
+                closeClient(oldest->fd);
+                fd = poller->accept(listener);
+            }
+        }
+        if (fd < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return ;
+            if (errno == ECONNABORTED || errno == EINTR)
+                continue ;
+            wslog.writeToLogFile(ERROR, "Accepting a new client failed, continuing without connecting the client", DEBUG_LOGS);
+            return ;
+        }
+        addClient(listener, fd);
     }
 }
 
 void EventLoop::timestamp()
 {
-    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
-    if (clients.empty() == false && now > lastTimeoutCheck + std::chrono::seconds(TIMEOUT + 1))
-        checkTimeouts();
-    if (clients.empty() == false && nChildren > 0 && now > lastChildrenCheck + std::chrono::seconds(CHILD_CHECK))
-        checkChildrenStatus();
+    now = std::chrono::steady_clock::now();
+}
+
+void EventLoop::wake()
+{
+    uint64_t one = 1;
+    if (write(wakeup.fd, &one, sizeof(one)) < 0)
+        wslog.writeToLogFile(ERROR, "Waking up worker " + std::to_string(id) + " failed", DEBUG_LOGS);
 }
 
 void EventLoop::startLoop()
 {
-    wslog.writeToLogFile(INFO, "Webserver ready", true);
-    lastChildrenCheck = std::chrono::steady_clock::now();
+    wslog.writeToLogFile(INFO, "Worker " + std::to_string(id) + " ready, using " + poller->name(), true);
+    now = std::chrono::steady_clock::now();
     while (signum == 0)
     {
-        timestamp();
-        int nReady = epoll_wait(loop, eventLog.data(), MAX_CONNECTIONS, 1000);
+        int nReady = poller->wait(eventLog, pendingReads.empty() ? timers.nextTimeout(now) : 0);
         if (nReady == -1)
         {
             if (errno == EINTR)
             {
-                wslog.writeToLogFile(INFO, "epoll_wait interrupted by signal", DEBUG_LOGS);
+                wslog.writeToLogFile(INFO, "Waiting for events interrupted by signal", DEBUG_LOGS);
                 if (signum != 0)
                     break ;
                 else
                     continue;
             }
             else
-                throw std::runtime_error("epoll_wait failed");
+                throw std::runtime_error("Waiting for events failed");
         }
         timestamp();
         for (int i = 0; i < nReady; i++)
         {
-            int fd = eventLog[i].data.fd;
-            int newFd;
-            if (servers.find(fd) != servers.end())
+            EventSource* source = static_cast<EventSource*>(eventLog[i].data.ptr);
+            if (source->sourceType == LISTENER)
+                acceptClient(*static_cast<Listener*>(source));
+            else if (source->sourceType == CLIENT)
             {
-                try {
-                    if (clients.empty() == true)
-                        lastTimeoutCheck = std::chrono::steady_clock::now();
-                    struct epoll_event setup { };
-                    Client newClient(loop, fd, clients, servers[fd]);
-                    auto result =  clients.emplace(newClient.fd, std::move(newClient));
-                    if (!result.second)
-                        throw std::runtime_error("Client insert failed or duplicate fd");
-                    newFd = newClient.fd;
-                    clients.at(newFd).erase = false;
-                    setup.data.fd = newClient.fd;
-                    setup.events = EPOLLIN;
-                    if (epoll_ctl(loop, EPOLL_CTL_ADD, newClient.fd, &setup) < 0)
-                        throw std::runtime_error("newClient epoll_ctl ADD failed");
-                    wslog.writeToLogFile(INFO, "Connecting a new client FD" + std::to_string(newClient.fd), true);
-                }
-                catch (const std::bad_alloc& e)
-                {
-                    wslog.writeToLogFile(ERROR, "Failed to add a client element into std::map due to bad alloc, continuing without connecting the client", DEBUG_LOGS);
+                Client& client = *static_cast<Client*>(source);
+                // Closed by an earlier event of this batch
+                if (client.fd == -1)
                     continue ;
-                }
-                catch (const std::runtime_error& e)
+                if (eventLog[i].events & EPOLLHUP || eventLog[i].events & EPOLLERR)
                 {
-                    std::string errorMessage = e.what();
-                    handleErrorMessages(errorMessage, clients, newFd);
+                    closeClient(client.fd);
                     continue ;
                 }
+                client.timestamp = now;
+                if (eventLog[i].events & (EPOLLIN | EPOLLRDHUP))
+                    handleClientRecv(client, eventLog[i].events);
+                progressClient(client);
+                chargeMemory(client);
             }
-            else if (clients.find(fd) != clients.end())
+            else if (source->sourceType == CHILD)
+                handleChildExit(*static_cast<ChildProcess*>(source));
+            else if (source->sourceType == CGI_STDIN || source->sourceType == CGI_STDOUT)
             {
-                if (eventLog[i].events & EPOLLHUP || eventLog[i].events & EPOLLERR)
-                {
-                    closeClient(fd);
+                CGIPipe& pipe = *static_cast<CGIPipe*>(source);
+                // Closed by an earlier event of this batch, or its client was
+                if (pipe.fd == -1 || pipe.client->fd == -1)
                     continue ;
-                }
-                if (eventLog[i].events & EPOLLIN)
-                {
-                    clients.at(fd).timestamp = std::chrono::steady_clock::now();
-                    handleClientRecv(clients.at(fd), eventLog[i].events);
-                }
-                if (eventLog[i].events & EPOLLOUT)
-                {
-                    clients.at(fd).timestamp = std::chrono::steady_clock::now();
-                    handleClientSend(clients.at(fd));
-                }
+                if (source->sourceType == CGI_STDIN)
+                    handleCGIInput(*pipe.client);
+                else
+                    handleCGIOutput(*pipe.client);
+                chargeMemory(*pipe.client);
+            }
+            else if (source->sourceType == WAKEUP)
+            {
+                uint64_t count;
+                if (read(wakeup.fd, &count, sizeof(count)) < 0)
+                    wslog.writeToLogFile(ERROR, "Reading the wakeup eventfd failed", DEBUG_LOGS);
             }
         }
+        resumeReads();
+        expireDeadlines();
+        balanceMemory();
+        recycleClients();
     }
 }
 
-void EventLoop::checkTimeouts()
+void EventLoop::setDeadline(Client& client, enum deadlineTypes deadline)
 {
-    wslog.writeToLogFile(INFO, "Checking timeouts", true);
-    lastTimeoutCheck = std::chrono::steady_clock::now();
-    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
-    for (auto it = clients.begin(); it != clients.end();)
+    int seconds = TIMEOUT;
+    switch (deadline)
     {
-        auto& client = it->second;
-        ++it;
-        int elapsedTime = std::chrono::duration_cast<std::chrono::seconds>(now - client.timestamp).count();
-        std::chrono::steady_clock::time_point timeout = client.timestamp + std::chrono::seconds(TIMEOUT);
-        if (now > timeout)
-        {
-            createErrorResponse(client, 408, "Request Timeout", " timed out due to inactivity!");
-            continue ;
-        }
-        if (client.state == READ && elapsedTime > 0)
-        {
-            int dataReceived = client.rawReadData.size() - client.previousDataAmount;
-            int dataRate = dataReceived / elapsedTime;
-            if ((client.rawReadData.size() > 64 && dataRate < 1024)
-                || (client.rawReadData.size() < 64 && dataReceived < 15))
-            {
-                createErrorResponse(client, 408, "Request Timeout", " disconnected, client sent data too slowly!");
-                continue ;
-            }
-        }
-        if (client.state == READ && checkMaxSize(client) != 0)
-        {
-            createErrorResponse(client, 413, "Payload Too Large", " disconnected, size too big!");
+        case HEADER_DEADLINE:
+            seconds = HEADER_TIMEOUT;
+            break ;
+        case BODY_DEADLINE:
+            seconds = BODY_TIMEOUT;
+            break ;
+        case CGI_DEADLINE:
+            seconds = CGI_TIMEOUT;
+            break ;
+        case SEND_DEADLINE:
+            seconds = SEND_TIMEOUT;
+            break ;
+        case TRIM_DEADLINE:
+            seconds = IDLE_TRIM_TIMEOUT;
+            break ;
+        case IDLE_DEADLINE:
+            seconds = KEEPALIVE_TIMEOUT - IDLE_TRIM_TIMEOUT;
+            break ;
+    }
+    client.deadline = deadline;
+    timers.arm(client.timer, now, std::chrono::seconds(seconds));
+}
+
+void EventLoop::expireDeadlines()
+{
+    expiredTimers.clear();
+    timers.advance(now, expiredTimers);
+    for (EventSource* source : expiredTimers)
+    {
+        Client& client = *static_cast<Client*>(source);
+        if (client.fd == -1)
             continue ;
-        }
-        if (client.state == SEND && elapsedTime > 0)
+        switch (client.deadline)
         {
-            int dataSent = client.previousDataAmount - client.writeBuffer.size();
-            int dataRate = dataSent / elapsedTime;
-            if (client.writeBuffer.size() > 1024 && dataRate < 1024)
-            {
+            case HEADER_DEADLINE:
+                createErrorResponse(client, 408, "Request Timeout", " timed out before sending the request headers!");
+                break ;
+            case BODY_DEADLINE:
+                createErrorResponse(client, 408, "Request Timeout", " stopped sending the request body!");
+                break ;
+            case CGI_DEADLINE:
+                createErrorResponse(client, 408, "Request Timeout", " timed out waiting for the CGI!");
+                break ;
+            case SEND_DEADLINE:
+                wslog.writeToLogFile(INFO, "Closing client FD" + std::to_string(client.fd) + ", it stopped reading the response", true);
                 closeClient(client.fd);
-                continue ;
-            }
-        } 
-        if (client.state == READ)
-            client.previousDataAmount = client.rawReadData.size();
-        else if (client.state == SEND)
-            client.previousDataAmount = client.writeBuffer.size();
+                break ;
+            case TRIM_DEADLINE:
+                client.trim();
+                chargeMemory(client);
+                setDeadline(client, IDLE_DEADLINE);
+                break ;
+            case IDLE_DEADLINE:
+                wslog.writeToLogFile(INFO, "Closing idle keep-alive client FD" + std::to_string(client.fd), DEBUG_LOGS);
+                closeClient(client.fd);
+                break ;
+        }
     }
 }
 
+// The caller sends right away, EPOLLOUT only matters once the kernel buffer is full
+static void queueResponse(Client& client, HTTPResponse response)
+{
+    AllocScope serializing(client.allocStats, PHASE_SERIALIZE);
+    client.response.push_back(std::move(response));
+    client.writeBuffer.clear();
+    client.response.back().serializeHeader(client.writeBuffer);
+    client.bytesSent = 0;
+    client.bodySent = 0;
+    HTTPResponse& queued = client.response.back();
+    client.responseSize = client.writeBuffer.size() + queued.body.size();
+    if (queued.fileFd != -1)
+        client.responseSize += queued.fileEnd - queued.fileOffset;
+    client.state = SEND;
+}
+
+// Header and in-memory body go out in one sendmsg(), a file body follows with sendfile()
+static ssize_t sendResponse(Client& client)
+{
+    HTTPResponse* response = client.response.empty() ? nullptr : &client.response.back();
+    if (response != nullptr && response->fileFd != -1 && client.writeBuffer.empty() && client.bodySent == response->body.size())
+    {
+        ssize_t sent = sendfile(client.fd, response->fileFd, &response->fileOffset, response->fileEnd - response->fileOffset);
+        if (sent > 0)
+            client.bytesSent += sent;
+        return sent;
+    }
+    struct iovec segments[2];
+    int nSegments = 0;
+    if (client.writeBuffer.empty() == false)
+        segments[nSegments++] = {const_cast<char*>(client.writeBuffer.data()), client.writeBuffer.size()};
+    if (client.response.empty() == false && client.bodySent < client.response.back().body.size())
+    {
+        std::string& body = client.response.back().body;
+        segments[nSegments++] = {body.data() + client.bodySent, body.size() - client.bodySent};
+    }
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = segments;
+    message.msg_iovlen = nSegments;
+    int flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+    if (response != nullptr && response->fileFd != -1 && response->fileOffset < response->fileEnd)
+        flags |= MSG_MORE;
+    ssize_t sent = sendmsg(client.fd, &message, flags);
+    if (sent > 0)
+    {
+        size_t fromHeader = std::min<size_t>(sent, client.writeBuffer.size());
+        client.writeBuffer.consume(fromHeader);
+        client.bodySent += sent - fromHeader;
+        client.bytesSent += sent;
+    }
+    return sent;
+}
+
 void EventLoop::createErrorResponse(Client &client, int code, std::string msg, std::string logMsg)
 {
     wslog.writeToLogFile(ERROR, "Client FD" + std::to_string(client.fd) + logMsg, true);
-    client.response.push_back(HTTPResponse(code, msg, client.serverInfo.error_pages));
-    client.writeBuffer = client.response.back().toString();
-    client.bytesWritten = send(client.fd, client.writeBuffer.data(), client.writeBuffer.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+    queueResponse(client, HTTPResponse(code, msg, client.serverInfo->error_pages));
+    client.bytesWritten = sendResponse(client);
     closeClient(client.fd);
 }
 
 void EventLoop::closeClient(int fd)
 {
-    if (epoll_ctl(loop, EPOLL_CTL_DEL, fd, nullptr) < 0)
-        throw std::runtime_error("timeout epoll_ctl DEL failed in closeClient");
-    if (clients.at(fd).request.isCGI == true)
-        nChildren--;
-    close(clients.at(fd).fd);
-    clients.erase(clients.at(fd).fd);
+    if (poller->remove(*clients.at(fd)) < 0)
+        throw std::runtime_error("timeout poller DEL failed in closeClient");
+    close(fd);
+    removeClient(fd);
+}
+
+void EventLoop::removeClient(int fd)
+{
+    // Later events of the batch may still point at it, it is freed in recycleClients()
+    timers.cancel(clients.at(fd)->timer);
+    if (clients.at(fd)->readPending)
+        std::erase(pendingReads, clients.at(fd).get());
+    if (clients.at(fd)->readPaused)
+        std::erase(pausedReads, clients.at(fd).get());
+    closeCGIPipes(*clients.at(fd));
+    releaseChild(*clients.at(fd));
+    if (clients.at(fd)->headerString.empty() == false)
+        clients.at(fd)->allocStats.finish(fd);
+    clients.at(fd)->fd = -1;
+    closedClients.push_back(std::move(clients.at(fd)));
+    nClients--;
 }
 
-void EventLoop::checkChildrenStatus()
+void EventLoop::recycleClients()
 {
-    lastChildrenCheck = std::chrono::steady_clock::now();
-    if (clients.empty() == true)
-        nChildren = 0;
-    for (auto it = clients.begin(); it != clients.end(); ++it)
+    for (std::unique_ptr<Client>& client : closedClients)
     {
-        auto& client = it->second;
-        if (nChildren > 0 && client.request.isCGI == true)
+        if (freeClients.size() >= CLIENT_POOL_SIZE)
         {
-            wslog.writeToLogFile(INFO, "Checking children status for client FD" + std::to_string(it->first), DEBUG_LOGS);
-            handleClientRecv(client, 0);
+            memoryBudget.charge(client->charged, 0);
             continue ;
         }
+        client->reset();
+        client->trim();
+        chargeMemory(*client);
+        freeClients.push_back(std::move(client));
     }
+    closedClients.clear();
 }
 
-static bool isHexUnsignedLongLong(std::string str)
+void EventLoop::progressClient(Client& client)
 {
-    std::stringstream ss(str);
-    long long unsigned value;
-    ss >> std::hex >> value;
-    return !ss.fail();
+    // Edge-triggered: keep driving the client until it has to wait
+    while (client.fd != -1 && client.state == SEND)
+    {
+        handleClientSend(client);
+        if (client.fd == -1 || client.state == SEND)
+            return ;
+        handleClientRecv(client, EPOLLIN);
+    }
 }
 
-static long long unsigned HexStrToUnsignedLongLong(std::string str)
+static void deferRead(Client& client, std::vector<Client*>& pendingReads)
 {
-    std::stringstream ss(str);
-    long long unsigned value;
-    ss >> std::hex >> value;
-    return value;
+    if (client.readPending == false)
+    {
+        client.readPending = true;
+        pendingReads.push_back(&client);
+    }
 }
 
-static bool validateChunkedBody(Client &client)
+void EventLoop::resumeReads()
 {
-    std::chrono::steady_clock::time_point timeout = std::chrono::steady_clock::now() + std::chrono::seconds(TIMEOUT);
-    client.chunkBodySize = 0;
-    while (client.chunkBuffer.empty() == false)
+    std::vector<Client*> resumed;
+    resumed.swap(pendingReads);
+    for (Client* client : resumed)
     {
-        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
-        if (now > timeout)
-            return false;
-        long long unsigned bytes = 0;
-        std::string str = client.chunkBuffer;
-        if (!isHexUnsignedLongLong(str))
-        {
-            return false;
-        }
-        bytes = HexStrToUnsignedLongLong(str);
-        long long unsigned i = 0;
-        while (str[i] != '\r' && i < str.size())
+        client->readPending = false;
+        if (client->fd == -1)
+            continue ;
+        handleClientRecv(*client, EPOLLIN);
+        progressClient(*client);
+        chargeMemory(*client);
+    }
+}
+
+void EventLoop::chargeMemory(Client& client)
+{
+    if (memoryBudget.limit != 0)
+        memoryBudget.charge(client.charged, client.memoryUsage());
+}
+
+// SIZE_MAX while the header is not in or the body is chunked
+static size_t remainingBody(const Client& client)
+{
+    if (client.headerString.empty())
+        return SIZE_MAX;
+    size_t length;
+    if (parseContentLength(client.request.headers.get(HEADER_CONTENT_LENGTH), length) == false)
+        return SIZE_MAX;
+    return length > client.rawReadData.size() ? length - client.rawReadData.size() : 0;
+}
+
+// Over the high watermark the heaviest readers are paused, except the one closest to done
+void EventLoop::balanceMemory()
+{
+    if (memoryBudget.overHigh())
+    {
+        // Idle keep-alive clients give their buffers back before anyone is paused
+        for (const std::unique_ptr<Client>& client : clients)
         {
-            if (!std::isxdigit(str[i]))
+            if (client && client->state == IDLE && client->charged != 0)
             {
-                return false;
+                client->trim();
+                chargeMemory(*client);
             }
-            i++;
         }
-        if (bytes == 0)
+        if (memoryBudget.overHigh() == false)
+            return ;
+        size_t total = 0;
+        size_t readers = 0;
+        Client* closest = nullptr;
+        for (const std::unique_ptr<Client>& client : clients)
         {
-            if (str.substr(1, 4) == "\r\n\r\n")
-                return true;
-            else
+            if (client && client->state == READ && client->readPaused == false)
             {
-                return false;
+                total += client->charged;
+                readers++;
+                if (closest == nullptr || remainingBody(*client) < remainingBody(*closest))
+                    closest = client.get();
             }
         }
-        if (str.size() > (i + 1) && (str[i + 1] != '\n'))
+        if (readers == 0)
         {
-            return false;
+            if (pausedReads.empty())
+                return ;
+            auto next = std::min_element(pausedReads.begin(), pausedReads.end(),
+                [](const Client* a, const Client* b) { return remainingBody(*a) < remainingBody(*b); });
+            (*next)->readPaused = false;
+            deferRead(**next, pendingReads);
+            pausedReads.erase(next);
+            return ;
         }
-        str = str.substr(i + 2);
-        if (client.request.fileUsed == true && client.request.isCGI == true) 
+        size_t mean = total / readers;
+        for (const std::unique_ptr<Client>& client : clients)
         {
-            int byteswritten = write(client.request.fileFd, str.substr(0, bytes).c_str(), bytes);
-            if (byteswritten < 0)
-                wslog.writeToLogFile(ERROR, "WRITE FAILED IN CHUNK", DEBUG_LOGS);
-            client.chunkBodySize += byteswritten;
+            if (client && client.get() != closest && client->state == READ && client->readPaused == false && client->charged >= mean)
+            {
+                wslog.writeToLogFile(INFO, "Memory budget exceeded, pausing reads from client FD" + std::to_string(client->fd), DEBUG_LOGS);
+                client->readPaused = true;
+                pausedReads.push_back(client.get());
+            }
         }
-        else
-            client.request.body += str.substr(0, bytes);
-        str = str.substr(bytes);
-        if (str.substr(0, 2) != "\r\n")
+    }
+    else if (pausedReads.empty() == false && memoryBudget.belowLow())
+    {
+        for (Client* client : pausedReads)
         {
-            return false;
+            client->readPaused = false;
+            deferRead(*client, pendingReads);
         }
-        else
-            str = str.substr(2);
-        client.chunkBuffer.erase(0, i + 2 + bytes + 2);
+        pausedReads.clear();
     }
-    return true;
 }
 
-void CGIMultipart(Client& client)
+int EventLoop::trackChild(Client& client)
 {
-    if (client.request.headers.count("Content-Type") == 0)
+    int pidfd = syscall(SYS_pidfd_open, client.CGI.childPid, 0);
+    if (pidfd < 0)
+        return -1;
+    std::unique_ptr<ChildProcess> child = std::make_unique<ChildProcess>();
+    child->sourceType = CHILD;
+    child->fd = pidfd;
+    child->pid = client.CGI.childPid;
+    child->client = &client;
+    if (poller->add(*child, EPOLLIN) < 0)
     {
-        wslog.writeToLogFile(ERROR, "400 Missing Content-Type", DEBUG_LOGS);
-        client.response.push_back(HTTPResponse(400, "Missing Content-Type", client.serverInfo.error_pages));
-        return;
+        close(pidfd);
+        return -1;
+    }
+    children[child->pid] = std::move(child);
+    return 0;
+}
+
+void EventLoop::releaseChild(Client& client)
+{
+    auto it = children.find(client.CGI.childPid);
+    if (it == children.end() || it->second->client != &client)
+        return ;
+    wslog.writeToLogFile(INFO, "Killing CGI child " + std::to_string(client.CGI.childPid) + " of client FD" + std::to_string(client.fd), DEBUG_LOGS);
+    it->second->client = nullptr;
+    kill(client.CGI.childPid, SIGKILL);
+}
+
+void EventLoop::handleChildExit(ChildProcess& child)
+{
+    int status = 0;
+    pid_t pid = child.pid;
+    pid_t reaped = waitpid(pid, &status, WNOHANG);
+    if (reaped == 0)
+        return ;
+    if (reaped == -1)
+        wslog.writeToLogFile(ERROR, "waitpid failed for CGI child " + std::to_string(pid) + ": " + strerror(errno), true);
+    Client* client = child.client;
+    if (poller->remove(child) < 0)
+        throw std::runtime_error("pidfd poller DEL failed in handleChildExit");
+    close(child.fd);
+    children.erase(pid);
+    // Without an exit status the CGI output cannot be trusted
+    if (reaped == -1)
+    {
+        if (client != nullptr)
+            createErrorResponse(*client, 500, "Internal Server Error", " lost its CGI child!");
+        return ;
+    }
+    if (client == nullptr)
+        return ;
+    finishCGI(*client, status);
+    progressClient(*client);
+}
+
+int EventLoop::watchCGIPipe(Client& client, CGIPipe& pipe, int fd, uint32_t events)
+{
+    pipe.fd = fd;
+    pipe.client = &client;
+    if (poller->add(pipe, events | EPOLLET) < 0)
+    {
+        pipe.fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+void EventLoop::unwatchCGIPipe(CGIPipe& pipe)
+{
+    if (pipe.fd == -1)
+        return ;
+    // The child still holds its copy of the pipe, closing ours would not take it out of the set
+    if (poller->remove(pipe) < 0)
+        throw std::runtime_error("CGI pipe poller DEL failed");
+    pipe.fd = -1;
+}
+
+void EventLoop::closeCGIPipes(Client& client)
+{
+    unwatchCGIPipe(client.CGI.childStdin);
+    unwatchCGIPipe(client.CGI.childStdout);
+    client.CGI.closePipes();
+}
+
+void EventLoop::handleCGIInput(Client& client)
+{
+    AllocScope handling(client.allocStats, PHASE_HANDLER);
+    if (client.CGI.writeBodyToChild(client.request) == 0)
+        return ;
+    unwatchCGIPipe(client.CGI.childStdin);
+    close(client.CGI.writeCGIPipe[1]);
+    client.CGI.writeCGIPipe[1] = -1;
+}
+
+void EventLoop::handleCGIOutput(Client& client)
+{
+    AllocScope handling(client.allocStats, PHASE_HANDLER);
+    int bytesRead = client.CGI.collectCGIOutput(client.CGI.getReadPipe());
+    while (bytesRead > 0)
+        bytesRead = client.CGI.collectCGIOutput(client.CGI.getReadPipe());
+    if (bytesRead == 0)
+    {
+        unwatchCGIPipe(client.CGI.childStdout);
+        close(client.CGI.readCGIPipe[0]);
+        client.CGI.readCGIPipe[0] = -1;
+    }
+}
+
+void EventLoop::finishCGI(Client& client, int status)
+{
+    client.state = SEND;
+    if (client.CGI.readCGIPipe[0] != -1 && !client.request.fileUsed)
+        handleCGIOutput(client);
+    closeCGIPipes(client);
+    client.CGI.fileOpen = false;
+    if (WIFSIGNALED(status) || (WIFEXITED(status) && WEXITSTATUS(status) != 0))
+    {
+        wslog.writeToLogFile(ERROR, "500 Internal Server Error", DEBUG_LOGS);
+        queueResponse(client, HTTPResponse(500, "Internal Server Error", client.serverInfo->error_pages));
+        client.request.isCGI = false;
+        return ;
+    }
+    if (!client.request.fileUsed)
+    {
+        queueResponse(client, client.CGI.generateCGIResponse(client.serverInfo->error_pages));
+        client.request.isCGI = false;
     }
-    auto its = client.request.headers.find("Content-Type");
-    std::string ct = its->second;
-    if (its == client.request.headers.end())
+}
+
+void CGIMultipart(Client& client)
+{
+    if (client.request.headers.has(HEADER_CONTENT_TYPE) == false)
     {
-        wslog.writeToLogFile(ERROR, "400 Invalid headers", DEBUG_LOGS);
-        client.response.push_back(HTTPResponse(400, "Invalid headers", client.serverInfo.error_pages));
+        wslog.writeToLogFile(ERROR, "400 Missing Content-Type", DEBUG_LOGS);
+        client.response.push_back(HTTPResponse(400, "Missing Content-Type", client.serverInfo->error_pages));
         return;
     }
+    std::string ct(client.request.headers.get(HEADER_CONTENT_TYPE));
     std::string boundary;
     std::string::size_type pos = ct.find("boundary=");
     if (pos == std::string::npos)
@@ -409,14 +754,14 @@ void CGIMultipart(Client& client)
         std::string& part = *it;
         if (part.empty() || part == "--\r\n" || part == "--")
             continue;
-        std::string disposition = part.substr(0, part.find("\r\n"));
+        std::string disposition = part.substr(0, scanSequence(part, 0, "\r\n"));
         if (disposition.find("filename=\"") == std::string::npos)
             continue; 
         std::string file = extractFilename(part, 1);
         if (file.empty())
             continue;
         std::string content = extractContent(part);
-        std::string folder = client.serverInfo.routes.at(client.request.location).upload_path;
+        std::string folder = client.serverInfo->routes.at(client.request.location).upload_path;
         std::string path = folder;
         if (path.back() != '/')
             path += "/";
@@ -426,7 +771,7 @@ void CGIMultipart(Client& client)
         if (!out.is_open())
         {
             wslog.writeToLogFile(ERROR, "500 Failed to open file for writing", DEBUG_LOGS);
-            client.response.push_back(HTTPResponse(500, "Failed to open file for writing", client.serverInfo.error_pages));
+            client.response.push_back(HTTPResponse(500, "Failed to open file for writing", client.serverInfo->error_pages));
             return;
         }
         out.write(content.c_str(), content.size());
@@ -435,7 +780,7 @@ void CGIMultipart(Client& client)
     if (lastPath.empty() || access(lastPath.c_str(), R_OK) != 0)
     {
         wslog.writeToLogFile(ERROR, "400 File not uploaded", DEBUG_LOGS);
-        client.response.push_back(HTTPResponse(400, "File not uploaded", client.serverInfo.error_pages));
+        client.response.push_back(HTTPResponse(400, "File not uploaded", client.serverInfo->error_pages));
         return;
     }    
     std::string ext = getFileExtension(client.request.path);
@@ -447,7 +792,7 @@ int EventLoop::executeCGI(Client& client)
 {
 	if (client.request.fileUsed)
 	{  
-        client.CGI.tempFileName = "/tmp/tempCGIoutput_" + std::to_string(std::time(NULL)); 
+        client.CGI.tempFileName = "/tmp/tempCGIoutput_" + std::to_string(std::time(NULL)) + "_" + std::to_string(client.fd);
 		client.CGI.readCGIPipe[1] =  open(client.CGI.tempFileName.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
 		client.CGI.fileOpen = true;
         if (client.request.multipart)
@@ -477,6 +822,10 @@ int EventLoop::executeCGI(Client& client)
         return -500;
     if (client.CGI.childPid == 0)
     {
+        // Worker threads block the shutdown signals, do not hand that mask to the script
+        sigset_t noSignals;
+        sigemptyset(&noSignals);
+        sigprocmask(SIG_SETMASK, &noSignals, nullptr);
 		closeFds();
         dup2(client.CGI.writeCGIPipe[0], STDIN_FILENO);
         dup2(client.CGI.readCGIPipe[1], STDOUT_FILENO);
@@ -490,7 +839,7 @@ int EventLoop::executeCGI(Client& client)
 			client.CGI.readCGIPipe[0] = -1;
 		}
         execve(client.CGI.execveArgs[0], client.CGI.execveArgs.data(), client.CGI.envArray.data());
-        std::exit(1);
+        _exit(1);
     }
 	if (!client.request.fileUsed)
 	{
@@ -506,9 +855,33 @@ int EventLoop::executeCGI(Client& client)
 		flags = fcntl(client.CGI.readCGIPipe[0], F_GETFL);
 		fcntl(client.CGI.readCGIPipe[0], F_SETFL, flags | O_NONBLOCK);
 	}
+    if (trackChild(client) < 0)
+    {
+        wslog.writeToLogFile(ERROR, "Tracking the CGI child failed", DEBUG_LOGS);
+        kill(client.CGI.childPid, SIGKILL);
+        waitpid(client.CGI.childPid, nullptr, 0);
+        return -500;
+    }
+    if (!client.request.fileUsed)
+    {
+        if (client.request.body.empty())
+        {
+            close(client.CGI.writeCGIPipe[1]);
+            client.CGI.writeCGIPipe[1] = -1;
+        }
+        if (watchCGIPipe(client, client.CGI.childStdout, client.CGI.readCGIPipe[0], EPOLLIN) < 0
+            || (client.CGI.writeCGIPipe[1] != -1 && watchCGIPipe(client, client.CGI.childStdin, client.CGI.writeCGIPipe[1], EPOLLOUT) < 0))
+        {
+            wslog.writeToLogFile(ERROR, "Adding the CGI pipes into the poller failed", DEBUG_LOGS);
+            closeCGIPipes(client);
+            releaseChild(client);
+            return -500;
+        }
+    }
 	return 0;
 }
 
+// Only a disconnect matters on the client socket while the CGI runs
 void EventLoop::handleCGI(Client& client, uint32_t eventType)
 {
     if (eventType & EPOLLIN)
@@ -522,81 +895,16 @@ void EventLoop::handleCGI(Client& client, uint32_t eventType)
             return ;
         }
     }
-
-    if (client.request.body.empty())
-    {
-        if (client.CGI.writeCGIPipe[1] != -1)
-        {
-            close(client.CGI.writeCGIPipe[1]);
-            client.CGI.writeCGIPipe[1] = -1;
-        }
-    }
-    if (!client.request.fileUsed && client.request.body.empty() == false)
-        client.CGI.writeBodyToChild(client.request);
-    else if (client.request.fileUsed == false)
-        client.CGI.collectCGIOutput(client.CGI.getReadPipe());
-    pid = waitpid(client.CGI.getChildPid(), &status, WNOHANG);
-    if (pid == client.CGI.getChildPid())
-    {
-        nChildren--;
-        client.state = SEND;
-        toggleEpollEvents(client.fd, loop, EPOLLOUT);
-        
-        if (WIFEXITED(status) && WEXITSTATUS(status) != 0)
-        {
-            wslog.writeToLogFile(ERROR, "500 Internal Server Error", DEBUG_LOGS);
-            client.response.push_back( HTTPResponse(500, "Internal Server Error", client.serverInfo.error_pages));
-            client.writeBuffer = client.response.back().toString();
-            return ;
-        }
-        if (!client.request.fileUsed)
-        {
-            client.CGI.collectCGIOutput(client.CGI.getReadPipe());
-            client.response.push_back(client.CGI.generateCGIResponse(client.serverInfo.error_pages));
-            client.writeBuffer = client.response.back().toString();
-        }
-        if (!client.CGI.tempFileName.empty())
-        {
-            if (client.CGI.readCGIPipe[1] != -1)
-                close(client.CGI.readCGIPipe[1]);
-            client.CGI.readCGIPipe[1] = -1;
-            client.CGI.fileOpen = false;
-        }
-        else
-        {
-            if (client.CGI.readCGIPipe[0] != -1)
-                close(client.CGI.readCGIPipe[0]);
-            client.CGI.readCGIPipe[0] = -1;
-        }
-        if (!client.request.fileUsed)
-            client.request.isCGI = false;
-        return ;
-    }
 }
 
 
-static bool checkMethods(Client &client, int loop)
-{
-    if (!RequestHandler::isAllowedMethod(client.request.method, client.serverInfo.routes[client.request.location]))
-    {
-        client.state = SEND;
-        wslog.writeToLogFile(ERROR, "405 Method not allowed", DEBUG_LOGS);
-        client.response.push_back(HTTPResponse(405, "Method not allowed", client.serverInfo.error_pages));
-        client.writeBuffer = client.response.back().toString();
-        toggleEpollEvents(client.fd, loop, EPOLLOUT);
-        return false;
-    }
-    else
-        return true;
-}
-
-static bool readChunkedBody(Client &client, int loop)
+// Returns 1 once the body is complete, 0 while more is to come, a negative status on error
+static int readChunkedBody(Client &client)
 {
-    client.chunkBuffer += client.rawReadData;
     if (client.request.fileUsed == false && client.request.isCGI == true)
     {
-        client.request.tempFileName = "/tmp/tempSaveFile " + std::to_string(std::time(NULL));
-        client.request.fileFd = open(client.request.tempFileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        client.request.tempFileName = "/tmp/tempSaveFile " + std::to_string(std::time(NULL)) + "_" + std::to_string(client.fd);
+        client.request.fileFd = open(client.request.tempFileName.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
         if (client.request.fileFd == -1)
             wslog.writeToLogFile(ERROR, "Opening temporary file for chunked request failed", DEBUG_LOGS);
         else
@@ -605,56 +913,55 @@ static bool readChunkedBody(Client &client, int loop)
             client.request.fileIsOpen = true;
         }
     }
-    if (client.chunkBuffer.find("0\r\n\r\n") != std::string::npos)
+    size_t maxBodySize = client.serverInfo->routes.at(client.request.location).client_max_body_size;
+    std::string_view input = client.rawReadData.view();
+    while (input.empty() == false && client.chunked.state != CHUNK_DONE)
     {
-        std::size_t endPos = client.chunkBuffer.find("0\r\n\r\n");
-        if (endPos != std::string::npos)
+        std::string_view data;
+        input.remove_prefix(client.chunked.decode(input, data));
+        if (client.chunked.state == CHUNK_ERROR)
         {
-            std::string leftover = client.chunkBuffer.substr(endPos + 5);
-            client.rawReadData.clear();
-            client.rawReadData += leftover;
-            client.chunkBuffer = client.chunkBuffer.substr(0, endPos + 5);
+            wslog.writeToLogFile(ERROR, "400 Invalid chunked body", DEBUG_LOGS);
+            return -400;
         }
-        if (!validateChunkedBody(client))
+        if (client.chunked.expected() > maxBodySize)
         {
-            if (client.request.isCGI == false)
-            {
-                if (checkMethods(client, loop) == false)
-                    return true;
-            }
-            else
-            {
-                wslog.writeToLogFile(ERROR, "400 Bad request", DEBUG_LOGS);
-                client.response.push_back(HTTPResponse(400, "Bad request", client.serverInfo.error_pages));
-                client.writeBuffer = client.response.back().toString();
-            }
-            client.state = SEND;
-            toggleEpollEvents(client.fd, loop, EPOLLOUT);
-            return true;
+            wslog.writeToLogFile(DEBUG, "Chunked body over the max body size of " + std::to_string(maxBodySize), DEBUG_LOGS);
+            return -413;
         }
-        if (client.request.fileUsed == true)
+        if (client.request.fileUsed == true && client.request.isCGI == true)
         {
-            client.request.headers["Content-Length"] = std::to_string(client.chunkBodySize);
-            if (client.request.fileIsOpen == true && client.request.fileFd != -1)
-                close(client.request.fileFd);
+            while (data.empty() == false)
+            {
+                ssize_t written = write(client.request.fileFd, data.data(), data.size());
+                if (written <= 0)
+                {
+                    wslog.writeToLogFile(ERROR, "Writing the chunked body to its file failed", DEBUG_LOGS);
+                    return -500;
+                }
+                data.remove_prefix(written);
+            }
         }
-        if (client.request.isCGI == true)
-            return true;
-        client.state = SEND;
-        client.response.push_back(RequestHandler::handleRequest(client));
-        client.writeBuffer = client.response.back().toString();
-        toggleEpollEvents(client.fd, loop, EPOLLOUT);
-        return true;
+        else
+            client.request.body.append(data);
     }
-    client.rawReadData.clear();
-    return false;
+    client.rawReadData.consume(client.rawReadData.size() - input.size());
+    if (client.chunked.state != CHUNK_DONE)
+        return 0;
+    if (client.request.fileUsed == true)
+    {
+        client.request.setHeader("Content-Length", std::to_string(client.chunked.bodySize));
+        if (client.request.fileIsOpen == true && client.request.fileFd != -1)
+            close(client.request.fileFd);
+    }
+    return 1;
 }
 
 int EventLoop::checkMaxSize(Client& client)
 {
     size_t maxBodySize;
-    auto ite = client.serverInfo.routes.find(client.request.location);
-    if (ite != client.serverInfo.routes.end())
+    auto ite = client.serverInfo->routes.find(client.request.location);
+    if (ite != client.serverInfo->routes.end())
         maxBodySize = ite->second.client_max_body_size;
     else
         return -400;
@@ -674,23 +981,48 @@ int EventLoop::checkMaxSize(Client& client)
     return 0;
 }
 
-void EventLoop::checkBody(Client& client, uint32_t eventType)
+void EventLoop::checkBody(Client& client)
 {
     if (client.request.method == "POST")
     {
-        auto TE = client.request.headers.find("Transfer-Encoding");
-        if (TE != client.request.headers.end() && TE->second == "chunked")
+        if (client.request.headers.get(HEADER_TRANSFER_ENCODING) == "chunked")
         {
-            if (readChunkedBody(client, loop) == false)
-                return;
+            int status = readChunkedBody(client);
+            if (status < 0)
+            {
+                if (status == -413)
+                    queueResponse(client, HTTPResponse(413, "Payload Too Large", client.serverInfo->error_pages));
+                else if (status == -400)
+                    queueResponse(client, HTTPResponse(400, "Bad request", client.serverInfo->error_pages));
+                else
+                    queueResponse(client, HTTPResponse(500, "Internal Server Error", client.serverInfo->error_pages));
+                client.erase = true;
+                client.rawReadData.clear();
+                return ;
+            }
+            if (status == 0)
+                return ;
+        }
+        else if (client.request.uploadFd != -1)
+        {
+            int status = RequestHandler::writeUpload(client);
+            if (status < 0)
+            {
+                queueResponse(client, HTTPResponse(500, "Internal Server Error", client.serverInfo->error_pages));
+                client.erase = true;
+                client.rawReadData.clear();
+                return ;
+            }
+            if (status == 0)
+                return ;
         }
         else
         {
-            auto CL = client.request.headers.find("Content-Length");
-            if (CL != client.request.headers.end() && client.rawReadData.size() >= stoul(CL->second))
+            size_t length;
+            if (parseContentLength(client.request.headers.get(HEADER_CONTENT_LENGTH), length) && client.rawReadData.size() >= length)
             {
-                client.request.body = client.rawReadData.substr(0, stoul(CL->second));
-                client.rawReadData = client.rawReadData.substr(client.request.body.size());
+                client.request.body.assign(client.rawReadData.view().substr(0, length));
+                client.rawReadData.consume(length);
             }
             else
                 return ;
@@ -700,23 +1032,17 @@ void EventLoop::checkBody(Client& client, uint32_t eventType)
     int maxSizeStatus = checkMaxSize(client);
     if (maxSizeStatus < 0)
     {
-        if (maxSizeStatus == -400)
-            client.response.push_back(HTTPResponse(400, "Bad Request"));
-        else if (maxSizeStatus == -413)
-            client.response.push_back(HTTPResponse(413, "Payload Too Large"));
+        if (maxSizeStatus == -413)
+            queueResponse(client, HTTPResponse(413, "Payload Too Large"));
+        else
+            queueResponse(client, HTTPResponse(400, "Bad Request"));
         client.erase = true;
-        client.writeBuffer = client.response.back().toString();
-        client.state = SEND;
-        toggleEpollEvents(client.fd, loop, EPOLLOUT);
         return ;
     }
     if (client.rawReadData.empty() == false)
     {
         wslog.writeToLogFile(ERROR, "501 Not implemented", DEBUG_LOGS);
-        client.response.push_back(HTTPResponse(501, "Not implemented", client.serverInfo.error_pages));
-        client.writeBuffer = client.response.back().toString();
-        client.state = SEND;
-        toggleEpollEvents(client.fd, loop, EPOLLOUT);
+        queueResponse(client, HTTPResponse(501, "Not implemented", client.serverInfo->error_pages));
         return ;
     }
     if (client.request.isCGI == true)
@@ -724,40 +1050,34 @@ void EventLoop::checkBody(Client& client, uint32_t eventType)
         if (client.request.multipart)
             CGIMultipart(client);
         client.state = HANDLE_CGI;
-        client.CGI.setEnvValues(client.request, client.serverInfo);
+        AllocScope handling(client.allocStats, PHASE_HANDLER);
+        client.CGI.setEnvValues(client.request, *client.serverInfo);
         int error = executeCGI(client);
         if (error < 0)
         {
             if (error == -500)
             {
                 wslog.writeToLogFile(ERROR, "500 Internal Server Error", DEBUG_LOGS);
-                client.response.push_back(HTTPResponse(500, "Internal Server Error", client.serverInfo.error_pages));
+                queueResponse(client, HTTPResponse(500, "Internal Server Error", client.serverInfo->error_pages));
             }
             else if (error == -403)
             {
                 wslog.writeToLogFile(ERROR, "403 Forbidden", DEBUG_LOGS);
-                client.response.push_back(HTTPResponse(403, "Forbidden", client.serverInfo.error_pages));
+                queueResponse(client, HTTPResponse(403, "Forbidden", client.serverInfo->error_pages));
             }
             else if (error == -404)
             {
                 wslog.writeToLogFile(ERROR, "404 Not Found", DEBUG_LOGS);
-                client.response.push_back(HTTPResponse(404, "Not Found", client.serverInfo.error_pages));
+                queueResponse(client, HTTPResponse(404, "Not Found", client.serverInfo->error_pages));
             }
-            client.writeBuffer = client.response.back().toString();
-            client.state = SEND;
-            toggleEpollEvents(client.fd, loop, EPOLLOUT);
             return ;
         }
-        nChildren++;
-        handleCGI(client, eventType);
+        setDeadline(client, CGI_DEADLINE);
         return ;
     }
     else
     {
-        client.response.push_back(RequestHandler::handleRequest(client));
-        client.writeBuffer = client.response.back().toString();
-        client.state = SEND;
-        toggleEpollEvents(client.fd, loop, EPOLLOUT);
+        queueResponse(client, RequestHandler::handleRequest(client));
         return ;
     }
 }
@@ -770,90 +1090,156 @@ bool EventLoop::validateRequestMethod(Client& client)
         return false;
 }
 
+static void adaptReadSize(Client& client)
+{
+    size_t bytesRead = client.bytesRead;
+    if (bytesRead == client.readSize && client.readSize < MAX_READ_BUFFER_SIZE)
+        client.readSize *= 2;
+    else if (bytesRead < client.readSize / 4 && client.readSize > READ_BUFFER_SIZE)
+        client.readSize /= 2;
+}
+
+// Grows the buffer once to the announced body size, if the memory budget allows it
+static void reserveBody(Client& client, const MemoryBudget& memoryBudget)
+{
+    auto route = client.serverInfo->routes.find(client.request.location);
+    if (route == client.serverInfo->routes.end() || client.request.uploadFd != -1)
+        return ;
+    size_t length;
+    if (parseContentLength(client.request.headers.get(HEADER_CONTENT_LENGTH), length) == false || length > route->second.client_max_body_size
+        || !memoryBudget.fits(length + MAX_READ_BUFFER_SIZE))
+        return ;
+    client.rawReadData.reserve(length + MAX_READ_BUFFER_SIZE);
+}
+
 void EventLoop::handleClientRecv(Client& client, uint32_t eventType)
 {
     try {
         switch (client.state)
         {
             case IDLE:
-            {
-                client.state = READ;
-                return ;
-            }
             case READ:
             {
-                client.bytesRead = 0;
-                client.bytesSent = 0;
-                char buffer[READ_BUFFER_SIZE];
-                client.bytesRead = recv(client.fd, buffer, sizeof(buffer) - 1, MSG_DONTWAIT | MSG_NOSIGNAL);
-                wslog.writeToLogFile(INFO, "Bytes read = " + std::to_string(client.bytesRead), DEBUG_LOGS);
-                if (client.bytesRead <= 0)
-                {
-                    if (client.bytesRead == 0)
-                        wslog.writeToLogFile(DEBUG, "Client FD" + std::to_string(client.fd) + " disconnected", true);
-                    if (epoll_ctl(loop, EPOLL_CTL_DEL, client.fd, nullptr) < 0)
-                        throw std::runtime_error("epoll_ctl DEL failed in READ");
-                    close(client.fd);
-                    clients.erase(client.fd);
+                if (client.readPaused)
                     return ;
-                }
-                buffer[client.bytesRead] = '\0';
-                std::string temp(buffer, client.bytesRead);
-                client.rawReadData += temp;
-                wslog.writeToLogFile(INFO, "Request received from client FD" + std::to_string(client.fd) + ":\n" + client.rawReadData, DEBUG_LOGS);
-                if (client.headerString.empty() == true)
+                AllocScope receiving(client.allocStats, PHASE_RECV);
+                // Edge-triggered: read until drained, a request is complete or the budget is spent
+                size_t budget = READ_BUDGET;
+                while (client.state == IDLE || client.state == READ)
                 {
-                    size_t headerEnd = client.rawReadData.find("\r\n\r\n");
-                    if (headerEnd != std::string::npos)
+                    if (budget == 0)
+                    {
+                        deferRead(client, pendingReads);
+                        return ;
+                    }
+                    client.bytesSent = 0;
+                    char* space = client.rawReadData.prepare(client.readSize);
+                    client.bytesRead = poller->receive(client, space, client.readSize);
+                    if (client.bytesRead > 0)
+                        client.rawReadData.commit(client.bytesRead);
+                    if (client.bytesRead < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                        return ;
+                    if (client.bytesRead <= 0)
+                    {
+                        if (client.bytesRead == 0)
+                            wslog.writeToLogFile(DEBUG, "Client FD" + std::to_string(client.fd) + " disconnected", true);
+                        if (poller->remove(client) < 0)
+                            throw std::runtime_error("poller DEL failed in READ");
+                        close(client.fd);
+                        removeClient(client.fd);
+                        return ;
+                    }
+                    // A new request on a kept-alive connection gets the full header time
+                    if (client.deadline == TRIM_DEADLINE || client.deadline == IDLE_DEADLINE)
+                        setDeadline(client, HEADER_DEADLINE);
+                    client.state = READ;
+                    budget -= std::min<size_t>(budget, client.bytesRead);
+                    adaptReadSize(client);
+                    if (client.headerString.empty() == true)
                     {
-                        client.headerString = client.rawReadData.substr(0, headerEnd + 4);
-                        client.findCorrectHost(client.headerString, client.serverInfoAll);
-                        client.request = HTTPRequest(client.headerString, client.serverInfo);
-                        if (validateHeader(client.request) == false || validateRequestMethod(client) == false)
+                        headerStates header = client.request.scanHeader(client.rawReadData.view());
+                        if (header == HEADER_TOO_LARGE)
                         {
-                            wslog.writeToLogFile(ERROR, "Validate request method is not valid", DEBUG_LOGS);
-                            if (validateRequestMethod(client) == false)
-                            {
-                                wslog.writeToLogFile(ERROR, "501 Not implemented", DEBUG_LOGS);
-                                client.response.push_back(HTTPResponse(501, "Not implemented", client.serverInfo.error_pages));
-                            }
-                            else
-                            {
-                                wslog.writeToLogFile(ERROR, "400 Bad request", DEBUG_LOGS);
-                                client.response.push_back(HTTPResponse(400, "Bad request", client.serverInfo.error_pages));
-                            }
+                            wslog.writeToLogFile(ERROR, "431 Request Header Fields Too Large", DEBUG_LOGS);
+                            queueResponse(client, HTTPResponse(431, "Request Header Fields Too Large", client.serverInfo->error_pages));
+                            client.erase = true;
                             client.rawReadData.clear();
-                            client.state = SEND;
-                            client.writeBuffer = client.response.back().toString();
-                            toggleEpollEvents(client.fd, loop, EPOLLOUT);
                             return ;
                         }
-                        wslog.writeToLogFile(DEBUG, client.headerString, DEBUG_LOGS);
-                        if (client.serverInfo.routes.find(client.request.location) == client.serverInfo.routes.end())
+                        if (header == HEADER_COMPLETE)
                         {
-                            wslog.writeToLogFile(ERROR, "404 Invalid location", DEBUG_LOGS);
-                            client.response.push_back(HTTPResponse(404, "Invalid location", client.serverInfo.error_pages));
-                            client.rawReadData.clear();
-                            client.state = SEND;
-                            client.writeBuffer = client.response.back().toString();
-                            toggleEpollEvents(client.fd, loop, EPOLLOUT);
-                            return ;
+                            // The fields point into headerString, which is kept until the request is done
+                            client.headerString.assign(client.rawReadData.view().substr(0, client.request.headerLength));
+                            client.rawReadData.consume(client.request.headerLength);
+                            {
+                                AllocScope parsing(client.allocStats, PHASE_PARSE);
+                                client.request.parse(client.headerString);
+                                client.findCorrectHost();
+                                client.request.route(*client.serverInfo);
+                            }
+                            if (validateHeader(client.request) == false || validateRequestMethod(client) == false)
+                            {
+                                wslog.writeToLogFile(ERROR, "Validate request method is not valid", DEBUG_LOGS);
+                                if (validateRequestMethod(client) == false)
+                                {
+                                    wslog.writeToLogFile(ERROR, "501 Not implemented", DEBUG_LOGS);
+                                    queueResponse(client, HTTPResponse(501, "Not implemented", client.serverInfo->error_pages));
+                                }
+                                else
+                                {
+                                    wslog.writeToLogFile(ERROR, "400 Bad request", DEBUG_LOGS);
+                                    queueResponse(client, HTTPResponse(400, "Bad request", client.serverInfo->error_pages));
+                                }
+                                client.rawReadData.clear();
+                                return ;
+                            }
+                            wslog.writeToLogFile(DEBUG, client.headerString, DEBUG_LOGS);
+                            if (client.serverInfo->routes.find(client.request.location) == client.serverInfo->routes.end())
+                            {
+                                wslog.writeToLogFile(ERROR, "404 Invalid location", DEBUG_LOGS);
+                                queueResponse(client, HTTPResponse(404, "Invalid location", client.serverInfo->error_pages));
+                                client.rawReadData.clear();
+                                return ;
+                            }
+                            if (client.serverInfo->routes.at(client.request.location).redirect.status_code)
+                            {
+                                queueResponse(client, HTTPResponse(client.serverInfo->routes.at(client.request.location).redirect.status_code, client.serverInfo->routes.at(client.request.location).redirect.target_url, client.serverInfo->error_pages));
+                                client.rawReadData.clear();
+                                return ;
+                            }
+                            // Answered before the body is read, a connection that announced one is closed
+                            HTTPResponse rejected;
+                            if (client.request.isCGI == false && RequestHandler::rejectRequest(client, rejected))
+                            {
+                                queueResponse(client, std::move(rejected));
+                                client.erase = client.request.headers.has(HEADER_CONTENT_LENGTH) || client.request.headers.has(HEADER_TRANSFER_ENCODING);
+                                client.rawReadData.clear();
+                                return ;
+                            }
+                            if (memoryBudget.overHigh())
+                            {
+                                createErrorResponse(client, 503, "Service Unavailable", " refused, memory budget exceeded");
+                                return ;
+                            }
+                            client.bytesRead = 0;
+                            if (RequestHandler::startUpload(client) < 0)
+                            {
+                                queueResponse(client, HTTPResponse(500, "Internal Server Error", client.serverInfo->error_pages));
+                                client.erase = true;
+                                client.rawReadData.clear();
+                                return ;
+                            }
+                            reserveBody(client, memoryBudget);
                         }
-                        client.bytesRead = 0;
-                        client.rawReadData = client.rawReadData.substr(headerEnd + 4);
-                        if (client.serverInfo.routes.at(client.request.location).redirect.status_code)
-                        {
-                            client.response.push_back(HTTPResponse(client.serverInfo.routes.at(client.request.location).redirect.status_code, client.serverInfo.routes.at(client.request.location).redirect.target_url, client.serverInfo.error_pages));
-                            client.rawReadData.clear();
-                            client.state = SEND;
-                            client.writeBuffer = client.response.back().toString();
-                            toggleEpollEvents(client.fd, loop, EPOLLOUT);
+                    }
+                    if (client.headerString.empty() == false)
+                    {
+                        setDeadline(client, BODY_DEADLINE);
+                        checkBody(client);
+                        if (client.fd == -1)
                             return ;
-                        }
                     }
                 }
-                if (client.headerString.empty() == false)
-                    checkBody(client, eventType);
                 return ;
             }
             case HANDLE_CGI:
@@ -866,154 +1252,149 @@ void EventLoop::handleClientRecv(Client& client, uint32_t eventType)
     {
         wslog.writeToLogFile(ERROR, "Client FD" + std::to_string(client.fd) + " suffered from invalid_argument in RECV, sending an error response!", DEBUG_LOGS);
         wslog.writeToLogFile(ERROR, "500 Internal Server Error", DEBUG_LOGS);
-        client.response.push_back(HTTPResponse(500, "Internal Server Error", client.serverInfo.error_pages));
+        queueResponse(client, HTTPResponse(500, "Internal Server Error", client.serverInfo->error_pages));
         client.rawReadData.clear();
-        client.state = SEND;
-        client.writeBuffer = client.response.back().toString();
-        toggleEpollEvents(client.fd, loop, EPOLLOUT);
         return ;
     }
     catch (const std::bad_alloc& e)
     {
         wslog.writeToLogFile(ERROR, "Client FD" + std::to_string(client.fd) + " suffered from bad_alloc in RECV, sending an error response!", DEBUG_LOGS);
         wslog.writeToLogFile(ERROR, "500 Internal Server Error", DEBUG_LOGS);
-        client.response.push_back(HTTPResponse(500, "Internal Server Error", client.serverInfo.error_pages));
+        queueResponse(client, HTTPResponse(500, "Internal Server Error", client.serverInfo->error_pages));
         client.rawReadData.clear();
-        client.state = SEND;
-        client.writeBuffer = client.response.back().toString();
-        toggleEpollEvents(client.fd, loop, EPOLLOUT);
         return ;
     }
 }
 
-static bool checkBytesSent(Client &client)
+// A CGI with a file body wrote its output to a file too, sent on block by block
+static bool refillFromCGIFile(Client& client)
 {
-    if (client.response.size() != 0)
+    if (client.CGI.fileOpen == false)
     {
-        int pos = client.response.back().toString().find("\r\n\r\n");
-        std::string responseHeader = client.response.back().toString().substr(0, pos + 4);
-        if (client.response.back().body.empty() == false)
+        client.CGI.readCGIPipe[1] = open(client.CGI.tempFileName.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat info;
+        if (client.CGI.readCGIPipe[1] == -1 || fstat(client.CGI.readCGIPipe[1], &info) == -1)
+            return false;
+        client.CGI.fileOpen = true;
+        char buffer[65536];
+        ssize_t bytesread = read(client.CGI.readCGIPipe[1], buffer, sizeof(buffer));
+        if (bytesread < 0)
+            return false;
+        client.CGI.output.assign(buffer, bytesread);
+        size_t headerEnd = scanSequence(client.CGI.output, 0, "\r\n\r\n");
+        if (headerEnd == std::string::npos)
         {
-            if ((std::stoul(client.response.back().headers["Content-Length"]) + responseHeader.size() > client.bytesSent))
-                return false;
+            queueResponse(client, client.CGI.generateCGIResponse(client.serverInfo->error_pages));
+            client.request.isCGI = false;
+            return true;
         }
-        else
-            if (client.bytesSent != responseHeader.size())
-                return false;
+        size_t bodySize = info.st_size - (headerEnd + 4);
+        queueResponse(client, client.CGI.generateCGIResponse(client.serverInfo->error_pages, bodySize));
+        client.responseSize = client.writeBuffer.size() + bodySize;
+        return true;
+    }
+    char* space = client.writeBuffer.prepare(65536);
+    ssize_t bytesread = read(client.CGI.readCGIPipe[1], space, 65536);
+    if (bytesread < 0)
+        return false;
+    client.writeBuffer.commit(bytesread);
+    if (bytesread == 0)
+    {
+        close(client.CGI.readCGIPipe[1]);
+        client.CGI.readCGIPipe[1] = -1;
+        client.request.isCGI = false;
     }
     return true;
 }
 
 void EventLoop::handleClientSend(Client &client)
 {
+    AllocScope sending(client.allocStats, PHASE_SEND);
     try {
-        if (client.state != SEND)
-            return ;
-        if (client.request.isCGI == true && client.CGI.tempFileName.empty() == false)
+        bool progressed = false;
+        while (client.state == SEND)
         {
-            client.writeBuffer.clear();
-            ssize_t bytesread = -1;
-            if (client.CGI.fileOpen == false)
-            {
-                client.CGI.readCGIPipe[1] = open(client.CGI.tempFileName.c_str(), O_RDONLY);
-                if (client.CGI.readCGIPipe[1] != -1)
-                    client.CGI.fileOpen = true;
-                char buffer[65536];
-                bytesread = read(client.CGI.readCGIPipe[1], buffer, 1000);
-                client.writeBuffer.append(buffer, bytesread);
-                client.CGI.output = client.writeBuffer;
-                client.response.push_back(client.CGI.generateCGIResponse(client.serverInfo.error_pages));
-                client.writeBuffer = client.response.back().toString();
-            }
-            else
+            if (client.request.isCGI == true && client.CGI.tempFileName.empty() == false && client.writeBuffer.empty()
+                && (client.response.empty() || client.bodySent == client.response.back().body.size()))
             {
-                char buffer[65536];
-                bytesread = read(client.CGI.readCGIPipe[1], buffer, 1000);
-                client.writeBuffer.append(buffer, bytesread);
+                if (refillFromCGIFile(client) == false)
+                {
+                    wslog.writeToLogFile(ERROR, "Reading the CGI output file failed", DEBUG_LOGS);
+                    closeClient(client.fd);
+                    return ;
+                }
             }
-            if (bytesread == -1)
+            client.bytesWritten = sendResponse(client);
+            if (client.bytesWritten < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
             {
-                wslog.writeToLogFile(ERROR, "500 Internal Server Error", DEBUG_LOGS);
-                client.response.push_back(HTTPResponse(500, "Internal Server Error", client.serverInfo.error_pages));
-                return;
+                // Armed only when the kernel could not take the response at once
+                if (progressed || client.deadline != SEND_DEADLINE)
+                    setDeadline(client, SEND_DEADLINE);
+                return ;
             }
-            else if (bytesread == 0)
+            if (client.bytesWritten <= 0)
             {
-                close(client.CGI.readCGIPipe[1]);
-                client.CGI.readCGIPipe[1] = -1;
+                if (poller->remove(client) < 0)
+                    throw std::runtime_error("check connection poller DEL failed in SEND");
+                wslog.writeToLogFile(DEBUG, "Closing client FD" + std::to_string(client.fd) + " because bytesWritten = " + std::to_string(client.bytesWritten), true);
+                close(client.fd);
+                removeClient(client.fd);
+                return ; 
             }
-        }
-        client.bytesWritten = send(client.fd, client.writeBuffer.c_str(), client.writeBuffer.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
-        wslog.writeToLogFile(DEBUG, "Response sent to client FD" + std::to_string(client.fd) + ":\n" + client.writeBuffer, DEBUG_LOGS);
-        if (client.bytesWritten <= 0)
-        {
-            if (epoll_ctl(loop, EPOLL_CTL_DEL, client.fd, nullptr) < 0)
-                throw std::runtime_error("check connection epoll_ctl DEL failed in SEND");
-            wslog.writeToLogFile(DEBUG, "Closing client FD" + std::to_string(client.fd) + " because bytesWritten = " + std::to_string(client.bytesWritten), true);
-            close(client.fd);
-            clients.erase(client.fd);
-            return ; 
-        }
-        client.bytesSent += client.bytesWritten;
-        client.writeBuffer.erase(0, client.bytesWritten);
-        if (checkBytesSent(client) == true)
-        {
-            wslog.writeToLogFile(DEBUG, "Response sent to client FD" + std::to_string(client.fd), true);
-            client.response.pop_back();
-            if (client.request.headers.find("Connection") != client.request.headers.end())
-                checkConnection = client.request.headers.at("Connection");
-            if (!checkConnection.empty())
+            progressed = true;
+            if (client.bytesSent >= client.responseSize)
             {
-                if (checkConnection == "close" || checkConnection == "Close")
+                wslog.writeToLogFile(DEBUG, "Response sent to client FD" + std::to_string(client.fd), true);
+                client.response.pop_back();
+                // Only this request's header counts, and its value is case-insensitive
+                std::string_view connection = client.request.headers.get(HEADER_CONNECTION);
+                if (equalsIgnoreCase(connection, "close"))
                 {
-                    if (epoll_ctl(loop, EPOLL_CTL_DEL, client.fd, nullptr) < 0)
-                        throw std::runtime_error("check connection epoll_ctl DEL failed in SEND::close");
+                    if (poller->remove(client) < 0)
+                        throw std::runtime_error("check connection poller DEL failed in SEND::close");
                     wslog.writeToLogFile(DEBUG, "Closing client FD" + std::to_string(client.fd) + " because of connection: close", true);
                     close(client.fd);
-                    clients.erase(client.fd);
+                    removeClient(client.fd);
+                    return ;
+                }
+                else if (connection.empty() && client.request.version == "HTTP/1.0")
+                {
+                    if (poller->remove(client) < 0)
+                        throw std::runtime_error("check connection poller DEL failed in SEND::http");
+                    wslog.writeToLogFile(DEBUG, "Closing client FD" + std::to_string(client.fd) + " because of http1.0", true);
+                    close(client.fd);
+                    removeClient(client.fd);
+                    return ;
+                }
+                else if (client.erase == true)
+                {
+                    if (poller->remove(client) < 0)
+                        throw std::runtime_error("check connection poller DEL failed in SEND::erase");
+                    wslog.writeToLogFile(DEBUG, "Closing client FD" + std::to_string(client.fd) + " because erase = true", true);
+                    close(client.fd);
+                    removeClient(client.fd);
+                    return ;
                 }
                 else
                 {
                     wslog.writeToLogFile(INFO, "Client reset", DEBUG_LOGS);
                     client.reset();
-                    toggleEpollEvents(client.fd, loop, EPOLLIN);
+                    setDeadline(client, TRIM_DEADLINE);
                 }
             }
-            else if (client.request.version == "HTTP/1.0")
-            {
-                if (epoll_ctl(loop, EPOLL_CTL_DEL, client.fd, nullptr) < 0)
-                    throw std::runtime_error("check connection epoll_ctl DEL failed in SEND::http");
-                wslog.writeToLogFile(DEBUG, "Closing client FD" + std::to_string(client.fd) + " because of http1.0", true);
-                close(client.fd);
-                clients.erase(client.fd);
-            }
-            else if (client.erase == true)
-            {
-                if (epoll_ctl(loop, EPOLL_CTL_DEL, client.fd, nullptr) < 0)
-                    throw std::runtime_error("check connection epoll_ctl DEL failed in SEND::erase");
-                wslog.writeToLogFile(DEBUG, "Closing client FD" + std::to_string(client.fd) + " because erase = true", true);
-                close(client.fd);
-                clients.erase(client.fd);
-            }
-            else
-            {
-                wslog.writeToLogFile(INFO, "Client reset", DEBUG_LOGS);
-                client.reset();
-                toggleEpollEvents(client.fd, loop, EPOLLIN);
-            }
         }
     }
     
     catch (const std::invalid_argument& e)
     {
-        closeClient(client.fd);
         wslog.writeToLogFile(ERROR, "Client FD" + std::to_string(client.fd) + " suffered from invalid_argument in SEND, closing client!", DEBUG_LOGS);
+        closeClient(client.fd);
         return ;
     }
     catch (const std::bad_alloc& e)
     {
-        closeClient(client.fd);
         wslog.writeToLogFile(ERROR, "Client FD" + std::to_string(client.fd) + " suffered from bad_alloc in SEND, closing client!", DEBUG_LOGS);
+        closeClient(client.fd);
         return ;
     }
 }
\ No newline at end of file
@@ -0,0 +1,39 @@
+#include "MemoryBudget.hpp"
+
+MemoryBudget::MemoryBudget(size_t budget) : used(0)
+{
+    limit = budget;
+    highWatermark = limit / 100 * MEMORY_HIGH_WATERMARK;
+    lowWatermark = limit / 100 * MEMORY_LOW_WATERMARK;
+}
+
+void MemoryBudget::charge(size_t& charged, size_t bytes)
+{
+    if (limit == 0 || bytes == charged)
+        return ;
+    if (bytes > charged)
+        used.fetch_add(bytes - charged, std::memory_order_relaxed);
+    else
+        used.fetch_sub(charged - bytes, std::memory_order_relaxed);
+    charged = bytes;
+}
+
+size_t MemoryBudget::inUse() const
+{
+    return used.load(std::memory_order_relaxed);
+}
+
+bool MemoryBudget::overHigh() const
+{
+    return limit != 0 && inUse() > highWatermark;
+}
+
+bool MemoryBudget::belowLow() const
+{
+    return limit == 0 || inUse() <= lowWatermark;
+}
+
+bool MemoryBudget::fits(size_t bytes) const
+{
+    return limit == 0 || inUse() + bytes <= highWatermark;
+}
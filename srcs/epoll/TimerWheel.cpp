@@ -0,0 +1,163 @@
+#include "TimerWheel.hpp"
+
+#include <bit>
+#include <chrono>
+#include <vector>
+
+#define SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+#define MAX_TICKS ((1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1)
+
+TimerNode::TimerNode()
+{
+    prev = nullptr;
+    next = nullptr;
+    expiry = 0;
+    slot = -1;
+    owner = nullptr;
+}
+
+TimerWheel::TimerWheel()
+{
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++)
+    {
+        occupied[level] = 0;
+        for (int i = 0; i < TIMER_WHEEL_SLOTS; i++)
+        {
+            slots[level][i].prev = &slots[level][i];
+            slots[level][i].next = &slots[level][i];
+        }
+    }
+    currentTick = 0;
+    nTimers = 0;
+    start = std::chrono::steady_clock::now();
+}
+
+uint64_t TimerWheel::toTick(std::chrono::steady_clock::time_point time) const
+{
+    if (time <= start)
+        return 0;
+    return std::chrono::duration_cast<std::chrono::milliseconds>(time - start).count() / TIMER_TICK_MS;
+}
+
+void TimerWheel::place(TimerNode& node)
+{
+    uint64_t delta = node.expiry - currentTick;
+    if (delta > MAX_TICKS)
+    {
+        node.expiry = currentTick + MAX_TICKS;
+        delta = MAX_TICKS;
+    }
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >= (1ULL << (TIMER_WHEEL_BITS * (level + 1))))
+        level++;
+    int index = (node.expiry >> (TIMER_WHEEL_BITS * level)) & SLOT_MASK;
+    TimerNode& head = slots[level][index];
+    node.prev = head.prev;
+    node.next = &head;
+    head.prev->next = &node;
+    head.prev = &node;
+    node.slot = level * TIMER_WHEEL_SLOTS + index;
+    occupied[level] |= 1ULL << index;
+}
+
+void TimerWheel::unlink(TimerNode& node)
+{
+    int level = node.slot / TIMER_WHEEL_SLOTS;
+    int index = node.slot % TIMER_WHEEL_SLOTS;
+    node.prev->next = node.next;
+    node.next->prev = node.prev;
+    node.prev = nullptr;
+    node.next = nullptr;
+    node.slot = -1;
+    TimerNode& head = slots[level][index];
+    if (head.next == &head)
+        occupied[level] &= ~(1ULL << index);
+}
+
+void TimerWheel::cascade(int level)
+{
+    TimerNode& head = slots[level][(currentTick >> (TIMER_WHEEL_BITS * level)) & SLOT_MASK];
+    while (head.next != &head)
+    {
+        TimerNode& node = *head.next;
+        unlink(node);
+        place(node);
+    }
+}
+
+void TimerWheel::arm(TimerNode& node, std::chrono::steady_clock::time_point now, std::chrono::milliseconds delay)
+{
+    if (node.slot != -1)
+        unlink(node);
+    else
+        nTimers++;
+    uint64_t expiry = toTick(now) + (delay.count() + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+    if (expiry <= currentTick)
+        expiry = currentTick + 1;
+    node.expiry = expiry;
+    place(node);
+}
+
+void TimerWheel::cancel(TimerNode& node)
+{
+    if (node.slot == -1)
+        return ;
+    unlink(node);
+    nTimers--;
+}
+
+bool TimerWheel::isArmed(const TimerNode& node) const
+{
+    return node.slot != -1;
+}
+
+// The caller handles the expired owners, the wheel is not modified while walked
+void TimerWheel::advance(std::chrono::steady_clock::time_point now, std::vector<EventSource*>& expired)
+{
+    uint64_t target = toTick(now);
+    while (currentTick < target)
+    {
+        if (nTimers == 0)
+        {
+            currentTick = target;
+            break ;
+        }
+        currentTick++;
+        int index = currentTick & SLOT_MASK;
+        for (int level = 1; index == 0 && level < TIMER_WHEEL_LEVELS; level++)
+        {
+            cascade(level);
+            index = (currentTick >> (TIMER_WHEEL_BITS * level)) & SLOT_MASK;
+        }
+        TimerNode& head = slots[0][currentTick & SLOT_MASK];
+        while (head.next != &head)
+        {
+            TimerNode& node = *head.next;
+            unlink(node);
+            nTimers--;
+            expired.push_back(node.owner);
+        }
+    }
+}
+
+// -1 when nothing is armed
+int TimerWheel::nextTimeout(std::chrono::steady_clock::time_point now) const
+{
+    if (nTimers == 0)
+        return -1;
+    uint64_t nextTick = (currentTick | SLOT_MASK) + 1;
+    uint64_t pending = std::rotr(occupied[0], (currentTick + 1) & SLOT_MASK);
+    if (pending != 0)
+    {
+        uint64_t nextExpiry = currentTick + 1 + std::countr_zero(pending);
+        bool higherLevels = false;
+        for (int level = 1; level < TIMER_WHEEL_LEVELS; level++)
+            higherLevels = higherLevels || occupied[level] != 0;
+        if (higherLevels == false || nextExpiry < nextTick)
+            nextTick = nextExpiry;
+    }
+    std::chrono::steady_clock::time_point wakeup = start + std::chrono::milliseconds(nextTick * TIMER_TICK_MS);
+    if (wakeup <= now)
+        return 0;
+    return std::chrono::ceil<std::chrono::milliseconds>(wakeup - now).count();
+}
@@ -0,0 +1,558 @@
+#include "UringPoller.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// The low bits of user_data tell which request of a registration completed
+enum uringOps
+{
+    OP_POLL,
+    OP_ACCEPT,
+    OP_RECV,
+    OP_IGNORE
+};
+
+#define OP_BITS 2
+
+static int uringSetup(unsigned entries, io_uring_params* params)
+{
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags, void* arg, size_t argSize)
+{
+    return syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, arg, argSize);
+}
+
+static int uringRegister(int fd, unsigned opcode, void* arg, unsigned nArgs)
+{
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nArgs);
+}
+
+UringPoller::UringPoller()
+{
+    sqRing = MAP_FAILED;
+    cqRing = MAP_FAILED;
+    sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    bufferRing = static_cast<io_uring_buf_ring*>(MAP_FAILED);
+    recvBuffers = static_cast<char*>(MAP_FAILED);
+    toSubmit = 0;
+    bufferTail = 0;
+    freeBuffers = 0;
+    // 0 marks the completions nobody waits for
+    nextToken = 1;
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    // Completions are only looked at in wait(), the kernel need not interrupt the loop
+    params.flags = IORING_SETUP_CLAMP | IORING_SETUP_COOP_TASKRUN;
+    ringFd = uringSetup(URING_ENTRIES, &params);
+    if (ringFd < 0 && errno == EINVAL)
+    {
+        memset(&params, 0, sizeof(params));
+        params.flags = IORING_SETUP_CLAMP;
+        ringFd = uringSetup(URING_ENTRIES, &params);
+    }
+    if (ringFd < 0)
+        throw std::runtime_error("io_uring_setup failed");
+    if (!(params.features & IORING_FEAT_EXT_ARG) || !(params.features & IORING_FEAT_SINGLE_MMAP))
+    {
+        release();
+        throw std::runtime_error("io_uring is missing required features");
+    }
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    sqRingSize = std::max(sqRingSize, cqRingSize);
+    cqRingSize = sqRingSize;
+    sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    cqRing = sqRing;
+    sqes = static_cast<io_uring_sqe*>(mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES));
+    if (sqRing == MAP_FAILED || sqes == MAP_FAILED)
+    {
+        release();
+        throw std::runtime_error("Mapping the io_uring rings failed");
+    }
+    char* sq = static_cast<char*>(sqRing);
+    char* cq = static_cast<char*>(cqRing);
+    sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    bufferRing = static_cast<io_uring_buf_ring*>(mmap(nullptr, URING_RECV_BUFFERS * sizeof(io_uring_buf),
+        PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    recvBuffers = static_cast<char*>(mmap(nullptr, URING_RECV_BUFFERS * URING_RECV_BUFFER_SIZE,
+        PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (bufferRing == MAP_FAILED || recvBuffers == MAP_FAILED)
+    {
+        release();
+        throw std::runtime_error("Allocating the io_uring receive buffers failed");
+    }
+    io_uring_buf_reg bufferSetup;
+    memset(&bufferSetup, 0, sizeof(bufferSetup));
+    bufferSetup.ring_addr = reinterpret_cast<uintptr_t>(bufferRing);
+    bufferSetup.ring_entries = URING_RECV_BUFFERS;
+    bufferSetup.bgid = 0;
+    if (uringRegister(ringFd, IORING_REGISTER_PBUF_RING, &bufferSetup, 1) < 0)
+    {
+        release();
+        throw std::runtime_error("io_uring has no provided buffer rings");
+    }
+    for (unsigned short buffer = 0; buffer < URING_RECV_BUFFERS; buffer++)
+        recycle(buffer);
+}
+
+void UringPoller::release()
+{
+    if (sqes != MAP_FAILED)
+        munmap(sqes, sqesSize);
+    if (sqRing != MAP_FAILED)
+        munmap(sqRing, sqRingSize);
+    close(ringFd);
+    if (bufferRing != MAP_FAILED)
+        munmap(bufferRing, URING_RECV_BUFFERS * sizeof(io_uring_buf));
+    if (recvBuffers != MAP_FAILED)
+        munmap(recvBuffers, URING_RECV_BUFFERS * URING_RECV_BUFFER_SIZE);
+}
+
+UringPoller::~UringPoller()
+{
+    for (auto& [token, registration] : registered)
+    {
+        for (const Completion& completion : registration.completed)
+        {
+            if (registration.source->sourceType == LISTENER && completion.result >= 0)
+                close(completion.result);
+        }
+    }
+    release();
+}
+
+// Without SQPOLL the kernel only reads the queue in io_uring_enter
+io_uring_sqe* UringPoller::getSqe()
+{
+    unsigned tail = *sqTail;
+    if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) > sqMask)
+    {
+        submit();
+        if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) > sqMask)
+            return nullptr;
+    }
+    io_uring_sqe* sqe = &sqes[tail & sqMask];
+    memset(sqe, 0, sizeof(*sqe));
+    sqArray[tail & sqMask] = tail & sqMask;
+    __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+    toSubmit++;
+    return sqe;
+}
+
+int UringPoller::submit()
+{
+    while (toSubmit > 0)
+    {
+        int submitted = uringEnter(ringFd, toSubmit, 0, 0, nullptr, 0);
+        if (submitted < 0 && errno == EINTR)
+            continue ;
+        if (submitted <= 0)
+            return -1;
+        toSubmit -= submitted;
+    }
+    return 0;
+}
+
+static uint32_t pollEvents(const EventSource& source, uint32_t events, bool direct)
+{
+    if (source.sourceType == LISTENER && direct == false)
+        return 0;
+    if (source.sourceType == CLIENT)
+        events &= ~(EPOLLIN | EPOLLRDHUP);
+    return events & ~EPOLLET;
+}
+
+int UringPoller::queuePoll(uint64_t token, const Registration& registration)
+{
+    uint32_t events = pollEvents(*registration.source, registration.events, registration.direct);
+    if (events == 0)
+        return 0;
+    io_uring_sqe* sqe = getSqe();
+    if (sqe == nullptr)
+    {
+        errno = EBUSY;
+        return -1;
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = registration.source->fd;
+    sqe->poll32_events = events;
+    if (registration.events & EPOLLET)
+        sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = token << OP_BITS | OP_POLL;
+    return 0;
+}
+
+int UringPoller::queueData(uint64_t token, Registration& registration)
+{
+    if (registration.source->sourceType != LISTENER && registration.source->sourceType != CLIENT)
+        return 0;
+    io_uring_sqe* sqe = getSqe();
+    if (sqe == nullptr)
+    {
+        errno = EBUSY;
+        return -1;
+    }
+    sqe->fd = registration.source->fd;
+    if (registration.source->sourceType == LISTENER)
+    {
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+        sqe->user_data = token << OP_BITS | OP_ACCEPT;
+    }
+    else
+    {
+        sqe->opcode = IORING_OP_RECV;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = 0;
+        sqe->user_data = token << OP_BITS | OP_RECV;
+    }
+    registration.armed = true;
+    registration.cancelling = false;
+    return 0;
+}
+
+void UringPoller::cancelData(uint64_t token, unsigned op)
+{
+    io_uring_sqe* sqe = getSqe();
+    if (sqe == nullptr)
+        return ;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = token << OP_BITS | op;
+    sqe->user_data = OP_IGNORE;
+}
+
+void UringPoller::recycle(unsigned short buffer)
+{
+    // bufs of the kernel header is misplaced in C++, the slots start at the ring itself
+    io_uring_buf& slot = reinterpret_cast<io_uring_buf*>(bufferRing)[bufferTail & (URING_RECV_BUFFERS - 1)];
+    slot.addr = reinterpret_cast<uintptr_t>(recvBuffers + static_cast<size_t>(buffer) * URING_RECV_BUFFER_SIZE);
+    slot.len = URING_RECV_BUFFER_SIZE;
+    slot.bid = buffer;
+    bufferTail++;
+    __atomic_store_n(&bufferRing->tail, bufferTail, __ATOMIC_RELEASE);
+    freeBuffers++;
+}
+
+void UringPoller::report(uint64_t token, Registration& registration, uint32_t events)
+{
+    if (registration.pending == 0)
+        ready.push_back(token);
+    registration.pending |= events;
+}
+
+void UringPoller::complete(uint64_t token, unsigned op, const io_uring_cqe& cqe)
+{
+    bool more = cqe.flags & IORING_CQE_F_MORE;
+    if (cqe.flags & IORING_CQE_F_BUFFER)
+        freeBuffers--;
+    auto it = registered.find(token);
+    if (it == registered.end())
+    {
+        // Late completions of a removed source give back what they took
+        if (cqe.flags & IORING_CQE_F_BUFFER)
+            recycle(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+        else if (op == OP_ACCEPT && cqe.res >= 0)
+            close(cqe.res);
+        return ;
+    }
+    Registration& registration = it->second;
+    if (op == OP_POLL)
+    {
+        if (cqe.res < 0)
+            report(token, registration, EPOLLERR);
+        else
+        {
+            report(token, registration, cqe.res);
+            if (!more)
+                rearm.push_back(token);
+        }
+        return ;
+    }
+    if (op == OP_RECV && cqe.res > 0)
+    {
+        registration.completed.push_back({cqe.res, static_cast<unsigned short>(cqe.flags >> IORING_CQE_BUFFER_SHIFT), 0});
+        report(token, registration, EPOLLIN);
+    }
+    // Out of buffers or cancelled for holding too many, the receive is only stopped
+    else if (cqe.res != -ENOBUFS && cqe.res != -ECANCELED)
+    {
+        registration.completed.push_back({cqe.res, 0, 0});
+        registration.ended = op == OP_RECV;
+        report(token, registration, EPOLLIN);
+    }
+    // Without a spare fd the kernel would fill the last one, accept4 keeps it as under epoll
+    if (op == OP_ACCEPT && (cqe.res == -EMFILE || cqe.res == -ENFILE) && !registration.direct)
+    {
+        registration.direct = true;
+        if (more)
+            cancelData(token, OP_ACCEPT);
+    }
+    if (!more)
+    {
+        registration.armed = false;
+        if (registration.direct && op == OP_ACCEPT)
+            rearm.push_back(token);
+        else if (!registration.ended)
+            stopped.push_back(token);
+    }
+    else if (op == OP_RECV && registration.completed.size() >= URING_RECV_QUEUE && !registration.cancelling)
+    {
+        registration.cancelling = true;
+        cancelData(token, OP_RECV);
+    }
+}
+
+void UringPoller::harvest()
+{
+    unsigned head = *cqHead;
+    unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++)
+    {
+        const io_uring_cqe& cqe = cqes[head & cqMask];
+        if ((cqe.user_data & ((1 << OP_BITS) - 1)) != OP_IGNORE)
+            complete(cqe.user_data >> OP_BITS, cqe.user_data & ((1 << OP_BITS) - 1), cqe);
+    }
+    __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+}
+
+// Receives restart once their client has read most of what they got, accepts right away
+void UringPoller::restart()
+{
+    std::vector<uint64_t> waiting;
+    waiting.swap(stopped);
+    for (uint64_t token : waiting)
+    {
+        auto it = registered.find(token);
+        if (it == registered.end() || it->second.armed || it->second.ended)
+            continue ;
+        Registration& registration = it->second;
+        if (registration.source->sourceType == CLIENT
+            && (freeBuffers == 0 || registration.completed.size() >= URING_RECV_QUEUE / 2))
+            stopped.push_back(token);
+        else
+            queueData(token, registration);
+    }
+}
+
+int UringPoller::add(EventSource& source, uint32_t events)
+{
+    uint64_t token = nextToken++;
+    Registration& registration = registered[token];
+    registration.source = &source;
+    registration.events = events;
+    registration.pending = 0;
+    registration.armed = false;
+    registration.cancelling = false;
+    registration.ended = false;
+    registration.direct = false;
+    if (queuePoll(token, registration) < 0 || queueData(token, registration) < 0)
+    {
+        registered.erase(token);
+        return -1;
+    }
+    tokens[&source] = token;
+    if (source.sourceType == LISTENER)
+        listeners.push_back(token);
+    return 0;
+}
+
+int UringPoller::remove(EventSource& source)
+{
+    auto it = tokens.find(&source);
+    if (it == tokens.end())
+    {
+        errno = ENOENT;
+        return -1;
+    }
+    uint64_t token = it->second;
+    tokens.erase(it);
+    Registration& registration = registered.at(token);
+    for (const Completion& completion : registration.completed)
+    {
+        if (source.sourceType == LISTENER && completion.result >= 0)
+            close(completion.result);
+        else if (source.sourceType == CLIENT && completion.result > 0)
+            recycle(completion.buffer);
+    }
+    bool polled = pollEvents(source, registration.events, registration.direct) != 0;
+    bool armed = registration.armed;
+    registered.erase(token);
+    std::erase(rearm, token);
+    std::erase(stopped, token);
+    std::erase(listeners, token);
+    // The requests hold a reference to the file, close() would not release the socket
+    if (polled)
+    {
+        io_uring_sqe* sqe = getSqe();
+        if (sqe == nullptr)
+        {
+            errno = EBUSY;
+            return -1;
+        }
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->addr = token << OP_BITS | OP_POLL;
+        sqe->user_data = OP_IGNORE;
+    }
+    if (armed)
+    {
+        io_uring_sqe* sqe = getSqe();
+        if (sqe == nullptr)
+        {
+            errno = EBUSY;
+            return -1;
+        }
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = token << OP_BITS | (source.sourceType == LISTENER ? OP_ACCEPT : OP_RECV);
+        sqe->user_data = OP_IGNORE;
+    }
+    return submit();
+}
+
+int UringPoller::wait(std::vector<epoll_event>& events, int timeout)
+{
+    for (uint64_t token : rearm)
+    {
+        auto it = registered.find(token);
+        if (it != registered.end())
+            queuePoll(token, it->second);
+    }
+    rearm.clear();
+    restart();
+    // Reported again like a level-triggered listener would be
+    for (uint64_t token : listeners)
+    {
+        Registration& registration = registered.at(token);
+        if (registration.completed.empty() == false)
+            report(token, registration, EPOLLIN);
+    }
+    harvest();
+    bool block = ready.empty() && timeout != 0;
+    if (toSubmit > 0 || block)
+    {
+        struct __kernel_timespec ts { };
+        io_uring_getevents_arg arg;
+        memset(&arg, 0, sizeof(arg));
+        if (timeout > 0)
+        {
+            ts.tv_sec = timeout / 1000;
+            ts.tv_nsec = (timeout % 1000) * 1000000L;
+            arg.ts = reinterpret_cast<uintptr_t>(&ts);
+        }
+        int submitted = uringEnter(ringFd, toSubmit, block ? 1 : 0,
+            (block ? IORING_ENTER_GETEVENTS : 0) | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+        if (submitted < 0 && errno != ETIME)
+            return -1;
+        if (submitted > 0)
+            toSubmit -= std::min<unsigned>(submitted, toSubmit);
+        if (submit() < 0)
+            return -1;
+        harvest();
+    }
+    size_t nReady = 0;
+    while (ready.empty() == false && nReady < events.size())
+    {
+        uint64_t token = ready.front();
+        ready.pop_front();
+        auto it = registered.find(token);
+        if (it == registered.end() || it->second.pending == 0)
+            continue ;
+        struct epoll_event event { };
+        event.events = it->second.pending;
+        event.data.ptr = it->second.source;
+        it->second.pending = 0;
+        events[nReady++] = event;
+    }
+    return nReady;
+}
+
+UringPoller::Registration* UringPoller::find(EventSource& source)
+{
+    auto it = tokens.find(&source);
+    if (it == tokens.end())
+        return nullptr;
+    return &registered.at(it->second);
+}
+
+int UringPoller::accept(EventSource& listener)
+{
+    Registration* registration = find(listener);
+    if (registration != nullptr && registration->direct && registration->completed.empty())
+        return accept4(listener.fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (registration == nullptr || registration->completed.empty())
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+    int result = registration->completed.front().result;
+    registration->completed.pop_front();
+    if (result < 0)
+    {
+        errno = -result;
+        return -1;
+    }
+    return result;
+}
+
+// The end of the stream stays queued, so every later call reports it
+ssize_t UringPoller::receive(EventSource& source, char* buffer, size_t size)
+{
+    Registration* registration = find(source);
+    if (registration == nullptr)
+    {
+        errno = EBADF;
+        return -1;
+    }
+    size_t copied = 0;
+    while (copied < size && registration->completed.empty() == false)
+    {
+        Completion& completion = registration->completed.front();
+        if (completion.result <= 0)
+        {
+            if (copied > 0)
+                break ;
+            if (completion.result == 0)
+                return 0;
+            errno = -completion.result;
+            return -1;
+        }
+        size_t take = std::min(size - copied, static_cast<size_t>(completion.result) - completion.offset);
+        memcpy(buffer + copied, recvBuffers + static_cast<size_t>(completion.buffer) * URING_RECV_BUFFER_SIZE + completion.offset, take);
+        copied += take;
+        completion.offset += take;
+        if (completion.offset == static_cast<size_t>(completion.result))
+        {
+            recycle(completion.buffer);
+            registration->completed.pop_front();
+        }
+    }
+    if (copied == 0)
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+    return copied;
+}
+
+const char* UringPoller::name() const
+{
+    return "io_uring";
+}
@@ -0,0 +1,162 @@
+#include "AllocStats.hpp"
+
+#ifdef ALLOC_STATS
+
+#include "Logger.hpp"
+#include <atomic>
+#include <bit>
+#include <cstdlib>
+#include <new>
+#include <string>
+
+// The scopes charge the difference between two readings to their phase
+static thread_local AllocCounters threadTotals;
+static thread_local AllocScope* currentScope = nullptr;
+
+static std::atomic<uint64_t> requests;
+static std::atomic<uint64_t> allocationHistogram[PHASE_COUNT][ALLOC_STATS_BUCKETS];
+static std::atomic<uint64_t> bytesHistogram[PHASE_COUNT][ALLOC_STATS_BUCKETS];
+static std::atomic<uint64_t> largeTotals[PHASE_COUNT];
+
+static const char* phaseNames[PHASE_COUNT] = {"recv", "parse", "route", "handler", "serialize", "send"};
+
+static void countAllocation(size_t size)
+{
+    threadTotals.allocations++;
+    threadTotals.bytes += size;
+    if (size >= ALLOC_STATS_LARGE)
+        threadTotals.large++;
+}
+
+void* operator new(size_t size)
+{
+    countAllocation(size);
+    void* ptr = std::malloc(size == 0 ? 1 : size);
+    if (ptr == nullptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void* operator new(size_t size, std::align_val_t align)
+{
+    countAllocation(size);
+    size_t alignment = static_cast<size_t>(align);
+    void* ptr = std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+    if (ptr == nullptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void* operator new[](size_t size, std::align_val_t align)
+{
+    return operator new(size, align);
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, size_t, std::align_val_t) noexcept { std::free(ptr); }
+
+AllocRecord::AllocRecord()
+{
+    for (AllocCounters& phase : phases)
+        phase = AllocCounters{};
+}
+
+static size_t bucket(uint64_t value)
+{
+    size_t index = std::bit_width(value);
+    return index < ALLOC_STATS_BUCKETS ? index : ALLOC_STATS_BUCKETS - 1;
+}
+
+// Logs what the request allocated and adds it to the histograms
+void AllocRecord::finish(int fd)
+{
+    // The request may end inside a scope, the send one usually
+    if (currentScope != nullptr)
+        currentScope->flush();
+    uint64_t allocations = 0;
+    for (const AllocCounters& phase : phases)
+        allocations += phase.allocations;
+    if (allocations == 0)
+        return ;
+    std::string line = "Client FD" + std::to_string(fd) + " request allocations:";
+    for (int i = 0; i < PHASE_COUNT; i++)
+    {
+        line += std::string(" ") + phaseNames[i] + " " + std::to_string(phases[i].allocations) + "/"
+            + std::to_string(phases[i].bytes) + "B";
+        if (phases[i].large > 0)
+            line += " (" + std::to_string(phases[i].large) + " large)";
+        allocationHistogram[i][bucket(phases[i].allocations)]++;
+        bytesHistogram[i][bucket(phases[i].bytes)]++;
+        largeTotals[i] += phases[i].large;
+        phases[i] = AllocCounters{};
+    }
+    requests++;
+    wslog.writeToLogFile(DEBUG, line, false);
+}
+
+AllocScope::AllocScope(AllocRecord& record, allocPhases phase)
+{
+    if (currentScope != nullptr)
+        currentScope->flush();
+    target = &record.phases[phase];
+    start = threadTotals;
+    outer = currentScope;
+    currentScope = this;
+}
+
+AllocScope::~AllocScope()
+{
+    flush();
+    currentScope = outer;
+    if (outer != nullptr)
+        outer->start = threadTotals;
+}
+
+void AllocScope::flush()
+{
+    target->allocations += threadTotals.allocations - start.allocations;
+    target->bytes += threadTotals.bytes - start.bytes;
+    target->large += threadTotals.large - start.large;
+    start = threadTotals;
+}
+
+static std::string histogramLine(std::atomic<uint64_t> (&histogram)[ALLOC_STATS_BUCKETS])
+{
+    std::string line;
+    for (size_t i = 0; i < ALLOC_STATS_BUCKETS; i++)
+    {
+        uint64_t count = histogram[i];
+        if (count == 0)
+            continue ;
+        if (i == 0)
+            line += " [0]:" + std::to_string(count);
+        else
+            line += " [" + std::to_string(uint64_t(1) << (i - 1)) + "+]:" + std::to_string(count);
+    }
+    return line;
+}
+
+// Per phase: requests by allocation count and bytes, in power of two buckets
+void reportAllocStats()
+{
+    wslog.writeToLogFile(DEBUG, "Allocations of " + std::to_string(requests.load()) + " requests", true);
+    for (int i = 0; i < PHASE_COUNT; i++)
+    {
+        wslog.writeToLogFile(DEBUG, std::string(phaseNames[i]) + " allocations per request:" + histogramLine(allocationHistogram[i]), true);
+        wslog.writeToLogFile(DEBUG, std::string(phaseNames[i]) + " bytes per request:" + histogramLine(bytesHistogram[i])
+            + ", large allocations " + std::to_string(largeTotals[i].load()), true);
+    }
+}
+
+#endif
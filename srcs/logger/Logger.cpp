@@ -23,9 +23,11 @@ std::string Logger::get_current_time_string()
 {
     auto now = std::chrono::system_clock::now();
     std::time_t now_c = std::chrono::system_clock::to_time_t(now);
+    struct tm local;
+    localtime_r(&now_c, &local);
 
     std::ostringstream oss;
-    oss << std::put_time(std::localtime(&now_c), "%F_%T ");  // Format: YYYY-MM-DD_HH:MM:SS
+    oss << std::put_time(&local, "%F_%T ");  // Format: YYYY-MM-DD_HH:MM:SS
     return oss.str();
 }
 
@@ -61,6 +63,7 @@ void Logger::writeToLogFile(LoggerStatus status, const std::string message, bool
         }
     }
 
+    std::lock_guard<std::mutex> lock(logmutex);
     if (toTerminal)
     {
         std::cout << logmessage.str();
@@ -73,5 +76,6 @@ void Logger::writeToLogFile(LoggerStatus status, const std::string message, bool
 
 Logger::~Logger()
 {
+    std::lock_guard<std::mutex> lock(logmutex);
     logstream.close();
 }
\ No newline at end of file
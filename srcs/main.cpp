@@ -1,10 +1,30 @@
+#include "AllocStats.hpp"
 #include "EventLoop.hpp"
 #include "Logger.hpp"
 #include "Parser.hpp"
+#include "utils.hpp"
 #include <iostream>
+#include <memory>
+#include <thread>
+#include <unistd.h>
+#include <vector>
 
 Logger wslog;
 
+static void runWorker(EventLoop* loop)
+{
+    try
+    {
+        loop->startLoop();
+    }
+    catch (const std::exception& e)
+    {
+        // One worker going down stops the others so the process exits as a whole
+        wslog.writeToLogFile(ERROR, "Worker " + std::to_string(loop->id) + " stopped: " + e.what(), true);
+        kill(getpid(), SIGTERM);
+    }
+}
+
 int main(int argc, char *argv[])
 {
     if (argc != 2)
@@ -17,9 +37,32 @@ int main(int argc, char *argv[])
         Parser parser(argv[1]);
         parser.printServerConfigs();
         wslog.writeToLogFile(INFO, "Parsing config file successfully", true);
-        EventLoop loop(parser.getServerConfigs());
-        loop.startLoop();
+        signal(SIGPIPE, handleSignals);
+        const GlobalConfig globalConfig = parser.getGlobalConfig();
+        const std::vector<ServerConfig> serverConfigs = parser.getServerConfigs();
+        MemoryBudget memoryBudget(globalConfig.memoryBudget);
+        // Each worker owns its poller, clients and SO_REUSEPORT listeners
+        std::vector<std::unique_ptr<EventLoop>> loops;
+        for (int i = 0; i < globalConfig.workers; i++)
+            loops.push_back(std::make_unique<EventLoop>(serverConfigs, globalConfig, memoryBudget, i));
+        // The main thread takes the shutdown signals and wakes every loop up
+        sigset_t shutdownSignals;
+        sigemptyset(&shutdownSignals);
+        sigaddset(&shutdownSignals, SIGINT);
+        sigaddset(&shutdownSignals, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &shutdownSignals, nullptr);
+        std::vector<std::thread> workers;
+        for (auto& loop : loops)
+            workers.emplace_back(runWorker, loop.get());
+        int received = 0;
+        sigwait(&shutdownSignals, &received);
+        signum = received;
+        for (auto& loop : loops)
+            loop->wake();
+        for (auto& worker : workers)
+            worker.join();
         std::cout << "Exiting eventLoop\n";
+        reportAllocStats();
     }
     catch (const std::invalid_argument& e)
     {
@@ -47,4 +90,4 @@ int main(int argc, char *argv[])
         return (1);
     }
     return 0;
-}
\ No newline at end of file
+}
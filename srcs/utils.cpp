@@ -1,5 +1,8 @@
 #include "utils.hpp"
 #include "Logger.hpp"
+#include "Scanner.hpp"
+#include <cctype>
+#include <charconv>
 #include <filesystem>
 #include <string>
 #include <vector>
@@ -13,7 +16,7 @@ std::string joinPaths(std::filesystem::path path1, std::filesystem::path path2)
 
 void handleSignals(int signal) 
 {
-    wslog.writeToLogFile(ERROR, "Signal received: " + std::to_string(signal), DEBUG_LOGS);
+    // Only async-signal-safe work here, the logger takes a mutex
     if (signal == SIGPIPE)
         signal = 0;
     else if (signal == SIGINT)
@@ -21,44 +24,33 @@ void handleSignals(int signal)
     return ;
 }
 
-bool validateHeader(HTTPRequest req)
+bool validateHeader(const HTTPRequest& req)
 {
     if (req.method.empty() || req.path.empty() || req.version.empty())
         return false;
     if (req.version != "HTTP/1.1" && req.version != "HTTP/1.0")
         return false;
-    if (req.version == "HTTP/1.1")
-    {
-        auto it = req.headers.find("Host");
-        if (it == req.headers.end())
-            return false;
-    }
-    auto it = req.headers.find("Invalid");
-    if (it != req.headers.end())
-    {
-        if (it->second == "Format")
-            return false;
-    }
-    it = req.headers.find("Duplicate");
-    if (it != req.headers.end())
-    {
-        if (it->second == "Key")
-            return false;
-    }
+    if (req.version == "HTTP/1.1" && req.headers.has(HEADER_HOST) == false)
+        return false;
+    if (req.malformed)
+        return false;
     if (req.method == "POST")
     {
         bool transferEncoding = false;
         bool contentLength = false;
-        auto it = req.headers.find("Transfer-Encoding");
-        if (it != req.headers.end())
+        if (req.headers.has(HEADER_TRANSFER_ENCODING))
         {
             transferEncoding = true;
-            if (it->second != "chunked")
+            if (req.headers.get(HEADER_TRANSFER_ENCODING) != "chunked")
                 return false;
         }
-        it = req.headers.find("Content-Length");
-        if (it != req.headers.end())
+        if (req.headers.has(HEADER_CONTENT_LENGTH))
+        {
+            size_t length;
+            if (parseContentLength(req.headers.get(HEADER_CONTENT_LENGTH), length) == false)
+                return false;
             contentLength = true;
+        }
 
         if ((transferEncoding == false && contentLength == false)
             || (transferEncoding == true && contentLength == true))
@@ -67,19 +59,49 @@ bool validateHeader(HTTPRequest req)
     return true;
 }
 
+bool parseContentLength(std::string_view value, size_t& length)
+{
+    std::from_chars_result result = std::from_chars(value.data(), value.data() + value.size(), length);
+    return (!value.empty() && result.ec == std::errc() && result.ptr == value.data() + value.size());
+}
+
+bool equalsIgnoreCase(std::string_view a, std::string_view b)
+{
+    if (a.size() != b.size())
+        return false;
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        if (std::tolower(static_cast<unsigned char>(a[i])) != std::tolower(static_cast<unsigned char>(b[i])))
+            return false;
+    }
+    return true;
+}
+
+// Value of a hex digit, -1 for any other character
+int hexValue(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
 std::vector<std::string> split(const std::string& s, const std::string& s2)
 {
     std::vector<std::string> result;
     size_t pos = 0;
     while (true)
     {
-        size_t start = s.find(s2, pos);
+        size_t start = scanSequence(s, pos, s2);
         if (start == std::string::npos)
             break;
         start += s2.length();
         while (start < s.size() && (s[start] == '-' || s[start] == '\r' || s[start] == '\n'))
             start++;
-        size_t end = s.find(s2, start);
+        size_t end = scanSequence(s, start, s2);
         std::string part = (end == std::string::npos) ? s.substr(start) : s.substr(start, end - start);
         while (!part.empty() && (part[0] == '\r' || part[0] == '\n'))
             part.erase(0, 1);
@@ -119,11 +141,11 @@ std::string extractFilename(const std::string& path, int method)
 
 std::string extractContent(const std::string& part)
 {
-    size_t start = part.find("\r\n\r\n");
+    size_t start = scanSequence(part, 0, "\r\n\r\n");
     size_t offset = 4;
     if (start == std::string::npos)
     {
-        start = part.find("\n\n");
+        start = scanSequence(part, 0, "\n\n");
         offset = 2;
     }
     if (start == std::string::npos)
@@ -16,14 +16,20 @@ including:
 
 One asynchronous test simulates multiple concurrent GET requests.
 
-Run tests with:
-    python3 -m pytest -v python_unit_tests.py
+Run tests from the repository root with:
+    python3 -m pytest -v tests/python_unit_tests.py
     or
-    python3 -m pytest -v python_unit_tests.py::test_repeated_requests (single test)
+    python3 -m pytest -v tests/python_unit_tests.py::test_repeated_requests (single test)
+
+WEBSERV picks the server binary (default ./webserver) and WEBSERV_CONF the
+configuration file (default tests/complete.conf), for example:
+    WEBSERV_CONF=tests/complete_uring.conf python3 -m pytest -v tests/python_unit_tests.py
 """
 
 import os
 from pathlib import Path
+import signal
+import socket
 import subprocess
 import time
 import requests
@@ -31,6 +37,69 @@ import pytest
 import asyncio
 import aiohttp
 
+WEBSERV = os.environ.get("WEBSERV", "./webserver")
+WEBSERV_CONF = os.environ.get("WEBSERV_CONF", "tests/complete.conf")
+
+
+def wait_for_port(proc, port, timeout=5):
+    """Wait until the server accepts connections on the port."""
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        assert proc.poll() is None, f"Server exited with {proc.returncode}"
+        try:
+            with socket.create_connection(("127.0.0.1", port), timeout=0.2):
+                return
+        except OSError:
+            time.sleep(0.05)
+    raise TimeoutError(f"Server did not listen on port {port}")
+
+
+def write_config(tmp_path, port, **directives):
+    """
+    Copy WEBSERV_CONF to tmp_path listening on another port, with the given
+    global directives added or replaced (e.g. workers=2).
+    """
+    text = Path(WEBSERV_CONF).read_text()
+    head, _, servers = text.partition("server {")
+    global_directives = {}
+    for line in head.splitlines():
+        line = line.strip().rstrip(";")
+        if line and not line.startswith("#"):
+            name, _, value = line.partition(" ")
+            global_directives[name] = value
+    global_directives.update({name: str(value) for name, value in directives.items()})
+    lines = [f"{name} {value};" for name, value in global_directives.items()]
+    servers = servers.replace("127.0.0.1:8080", f"127.0.0.1:{port}")
+    config = tmp_path / "webserv.conf"
+    config.write_text("\n".join(lines) + "\n\nserver {" + servers)
+    return config
+
+
+def stop_server(proc):
+    """
+    Stop the server with SIGTERM so it closes its listeners before the next
+    test binds the port again, io_uring rings outlive a killed process for a while.
+    """
+    proc.send_signal(signal.SIGTERM)
+    try:
+        proc.wait(timeout=5)
+    except subprocess.TimeoutExpired:
+        proc.kill()
+        proc.wait()
+
+
+def start_custom_server(tmp_path, port=8081, **directives):
+    """Start a second server from write_config, the caller stops it."""
+    proc = subprocess.Popen([WEBSERV, str(write_config(tmp_path, port, **directives))],
+                            stdout=subprocess.DEVNULL)
+    try:
+        wait_for_port(proc, port)
+    except Exception:
+        proc.kill()
+        raise
+    return proc
+
+
 ########################################################################
 # Fixture: Start a fresh server instance for each test (function-scoped)
 ########################################################################
@@ -38,11 +107,11 @@ import aiohttp
 def start_server():
     print("\n=== Starting server ===")
     # Launch the server with the specified configuration file.
-    proc = subprocess.Popen(["./webserv", "complete.conf"])
-    time.sleep(0.1)  # Allow time for the server to start.
+    proc = subprocess.Popen([WEBSERV, WEBSERV_CONF], stdout=subprocess.DEVNULL)
+    wait_for_port(proc, 8080)
     yield proc
     print("=== Stopping server ===")
-    proc.kill()
+    stop_server(proc)
 
 
 ########################################################################
@@ -100,7 +169,7 @@ def test_images_delete():
     """
 
     # Setup: Create a test directory and file
-    base_dir = Path("home/images")
+    base_dir = Path("www/images")
     test_file = base_dir / "random.file"
     base_dir.mkdir(parents=True, exist_ok=True)
     test_file.write_text("Temporary file content.")
@@ -233,10 +302,10 @@ def test_client_body_size_exceeded():
 def test_file_upload_and_check():
     """
     Test that uploading a file through a POST request is successful and 
-    that the file is correctly saved in the 'home/images' directory.
+    that the file is correctly saved in the 'www/images' directory.
     
     Assumes the server routes POST requests to /images/ to the directory:
-      ./home/images
+      ./www/images
     """
     import time
     from pathlib import Path
@@ -377,7 +446,7 @@ async def test_concurrent_get_and_post():
 
 
     async with aiohttp.ClientSession() as session:
-        test_file = Path("home/images/uploads/filename.txt")
+        test_file = Path("www/images/filename.txt")
         # Create tasks for GET requests
         get_tasks = [session.get(get_url) for _ in range(num_get)]
         
@@ -495,3 +564,321 @@ def test_idle_disconnect_incomplete_body():
         # After the 408, the server should close the connection
         eof = sock.recv(1024)
         assert eof == b'', f"Expected EOF (b''), but got {eof!r}"
+
+
+########################################################################
+# Worker threads
+########################################################################
+
+def test_workers_threads_and_shutdown(tmp_path):
+    """
+    Test that workers 2 runs two event loop threads next to the main thread,
+    that both serve requests, and that SIGTERM stops the server cleanly.
+    """
+    proc = start_custom_server(tmp_path, workers=2)
+    try:
+        assert len(os.listdir(f"/proc/{proc.pid}/task")) == 3
+        for _ in range(20):
+            response = requests.get("http://127.0.0.1:8081/index.html")
+            assert response.status_code == 200
+        proc.send_signal(signal.SIGTERM)
+        assert proc.wait(timeout=5) == 0
+    finally:
+        stop_server(proc)
+
+
+def test_single_worker_shutdown(tmp_path):
+    """Test that workers 1 also stops on SIGTERM and SIGINT."""
+    for signum in (signal.SIGTERM, signal.SIGINT):
+        proc = start_custom_server(tmp_path, workers=1)
+        try:
+            assert requests.get("http://127.0.0.1:8081/index.html").status_code == 200
+            proc.send_signal(signum)
+            assert proc.wait(timeout=5) == 0
+        finally:
+            stop_server(proc)
+
+
+def test_accept_batch(tmp_path):
+    """
+    Test that a burst of connections is served with the smallest and the
+    largest accept_batch, leftovers of a batch are picked up on the next wakeup.
+    """
+    for batch in (1, 4096):
+        proc = start_custom_server(tmp_path, accept_batch=batch)
+        try:
+            sockets = [socket.create_connection(("127.0.0.1", 8081), timeout=5) for _ in range(200)]
+            for sock in sockets:
+                sock.sendall(b"GET /index.html HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: close\r\n\r\n")
+            for sock in sockets:
+                response = sock.recv(1024)
+                assert response.startswith(b"HTTP/1.1 200"), f"accept_batch {batch}: {response[:40]!r}"
+                sock.close()
+        finally:
+            stop_server(proc)
+
+
+def test_event_engine_io_uring(tmp_path):
+    """
+    Test that event_engine io_uring gives every worker a ring and that the
+    server serves keep-alive requests and an upload through it.
+    """
+    proc = start_custom_server(tmp_path, event_engine="io_uring", workers=2)
+    try:
+        fd_dir = f"/proc/{proc.pid}/fd"
+        rings = [fd for fd in os.listdir(fd_dir) if "io_uring" in os.readlink(f"{fd_dir}/{fd}")]
+        assert len(rings) == 2
+        with requests.Session() as session:
+            for _ in range(20):
+                assert session.get("http://127.0.0.1:8081/index.html").status_code == 200
+        # Spans many of the ring's receive buffers
+        content = os.urandom(1000000)
+        upload_path = Path("www/images/uring_upload.bin")
+        response = requests.post("http://127.0.0.1:8081/images/", files={"file": (upload_path.name, content)})
+        assert response.status_code in (200, 201)
+        assert upload_path.read_bytes() == content
+        upload_path.unlink()
+    finally:
+        stop_server(proc)
+
+
+def test_memory_budget_watermarks(tmp_path):
+    """
+    Test that uploads holding the memory budget past its high watermark get
+    new requests refused with 503, that the paused uploads still finish, and
+    that requests are served again once usage is back under the low watermark.
+    """
+    size = 4000000
+    proc = start_custom_server(tmp_path, memory_budget="8M")
+    try:
+        uploads = []
+        for i in range(12):
+            sock = socket.create_connection(("127.0.0.1", 8081), timeout=30)
+            sock.setblocking(False)
+            body = (b"--BUDGET\r\nContent-Disposition: form-data; name=\"file\"; filename=\"budget_%d.bin\"\r\n"
+                    b"Content-Type: application/octet-stream\r\n\r\n" % i + b"q" * size + b"\r\n--BUDGET--\r\n")
+            header = (b"POST /images/ HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: close\r\n"
+                      b"Content-Type: multipart/form-data; boundary=BUDGET\r\nContent-Length: %d\r\n\r\n" % len(body))
+            uploads.append([sock, header + body, 0])
+        # Three quarters of every body, as far as the server takes them
+        deadline = time.time() + 3
+        while time.time() < deadline:
+            for upload in uploads:
+                sock, data, sent = upload
+                if sent < 3 * len(data) // 4:
+                    try:
+                        upload[2] += sock.send(data[sent:min(sent + 65536, 3 * len(data) // 4)])
+                    except BlockingIOError:
+                        pass
+            time.sleep(0.001)
+        response = requests.get("http://127.0.0.1:8081/index.html", headers={"Connection": "close"})
+        assert response.status_code == 503
+        # The rest round-robin, the server only reads some of the uploads at a time
+        deadline = time.time() + 30
+        while any(sent < len(data) for _, data, sent in uploads) and time.time() < deadline:
+            for upload in uploads:
+                sock, data, sent = upload
+                if sent < len(data):
+                    try:
+                        upload[2] += sock.send(data[sent:sent + 65536])
+                    except BlockingIOError:
+                        pass
+            time.sleep(0.001)
+        for sock, _, _ in uploads:
+            sock.setblocking(True)
+            status_line = sock.recv(1024).split(b"\r\n")[0]
+            assert status_line.startswith((b"HTTP/1.1 200", b"HTTP/1.1 201")), status_line
+            sock.close()
+        for i in range(12):
+            assert Path(f"www/images/budget_{i}.bin").stat().st_size == size
+        time.sleep(0.3)
+        assert requests.get("http://127.0.0.1:8081/index.html").status_code == 200
+    finally:
+        stop_server(proc)
+        for upload_path in Path("www/images").glob("budget_*.bin"):
+            upload_path.unlink()
+
+
+def test_streamed_upload_replaces_atomically():
+    """
+    Test that a plain upload past client_body_buffer_size is stored byte for
+    byte, that the old file stays intact until the whole body is in, and that
+    the replaced file keeps its permissions.
+    """
+    target = Path("www/images/stream_target.bin")
+    target.write_bytes(b"old content")
+    target.chmod(0o640)
+    content = os.urandom(4000000)
+    try:
+        with socket.create_connection(("127.0.0.1", 8080), timeout=10) as sock:
+            sock.sendall(b"POST /images/stream_target.bin HTTP/1.1\r\nHost: 127.0.0.1\r\n"
+                         b"Content-Type: application/octet-stream\r\nContent-Length: %d\r\n\r\n" % len(content))
+            sock.sendall(content[:len(content) // 2])
+            time.sleep(0.3)
+            assert target.read_bytes() == b"old content"
+            sock.sendall(content[len(content) // 2:])
+            status_line = sock.recv(1024).split(b"\r\n")[0]
+        assert status_line.startswith((b"HTTP/1.1 200", b"HTTP/1.1 201")), status_line
+        assert target.read_bytes() == content
+        assert target.stat().st_mode & 0o777 == 0o640
+        assert list(target.parent.glob("stream_target.bin.part*")) == []
+    finally:
+        target.unlink()
+
+
+def test_disallowed_upload_refused_before_body():
+    """Test that a POST to a GET-only route gets 405 without its body being sent."""
+    with socket.create_connection(("127.0.0.1", 8080), timeout=5) as sock:
+        sock.sendall(b"POST /newDir/upload.bin HTTP/1.1\r\nHost: 127.0.0.1\r\n"
+                     b"Content-Type: application/octet-stream\r\nContent-Length: 4000000\r\n\r\n")
+        status_line = sock.recv(1024).split(b"\r\n")[0]
+    assert status_line.startswith(b"HTTP/1.1 405"), status_line
+
+
+def read_status_line(sock):
+    """Read up to the end of the first line of a response."""
+    data = b""
+    while b"\r\n" not in data:
+        chunk = sock.recv(1024)
+        if not chunk:
+            break
+        data += chunk
+    return data.split(b"\r\n")[0]
+
+
+def test_oversized_header():
+    """
+    Test that a header past the size limit gets 431, both when it is complete
+    and when its end has not arrived yet.
+    """
+    filler = b"X-Filler: " + b"a" * 10000 + b"\r\n"
+    for ending in (b"\r\n", b""):
+        with socket.create_connection(("127.0.0.1", 8080), timeout=5) as sock:
+            sock.sendall(b"GET /index.html HTTP/1.1\r\nHost: 127.0.0.1\r\n" + filler + ending)
+            status_line = read_status_line(sock)
+        assert status_line.startswith(b"HTTP/1.1 431"), status_line
+
+
+def test_header_in_small_reads():
+    """
+    Test that a header arriving a few bytes at a time, with the blank line
+    split between reads, is parsed once it is complete.
+    """
+    request = b"GET /index.html HTTP/1.1\r\nHost: 127.0.0.1\r\nUser-Agent: pieces\r\nConnection: close\r\n\r\n"
+    with socket.create_connection(("127.0.0.1", 8080), timeout=5) as sock:
+        sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        head = request[:-2]
+        pieces = [head[start:start + 5] for start in range(0, len(head), 5)] + [b"\r\n"]
+        for piece in pieces:
+            sock.sendall(piece)
+            time.sleep(0.01)
+        status_line = read_status_line(sock)
+    assert status_line.startswith(b"HTTP/1.1 200"), status_line
+
+
+def read_response(sock):
+    """Read one response with a Content-Length body, returns (header, body)."""
+    data = b""
+    while b"\r\n\r\n" not in data:
+        chunk = sock.recv(65536)
+        assert chunk, f"Connection closed before the header: {data!r}"
+        data += chunk
+    header, body = data.split(b"\r\n\r\n", 1)
+    length = 0
+    for line in header.split(b"\r\n")[1:]:
+        name, _, value = line.partition(b":")
+        if name.strip().lower() == b"content-length":
+            length = int(value)
+    while len(body) < length:
+        chunk = sock.recv(65536)
+        assert chunk, "Connection closed before the body"
+        body += chunk
+    return header, body
+
+
+def test_header_names_case_insensitive():
+    """Test that lowercase and mixed-case Host and Content-Length are recognized."""
+    with socket.create_connection(("127.0.0.1", 8080), timeout=5) as sock:
+        sock.sendall(b"GET /index.html HTTP/1.1\r\nhost: 127.0.0.1\r\n\r\n")
+        header, _ = read_response(sock)
+        assert header.startswith(b"HTTP/1.1 200"), header
+        sock.sendall(b"POST /cgi/test.py HTTP/1.1\r\nHOST: 127.0.0.1\r\ncOnTeNt-LeNgTh: 5\r\n"
+                     b"content-type: text/plain\r\n\r\nhello")
+        header, body = read_response(sock)
+        assert header.startswith(b"HTTP/1.1 200"), header
+        # The script echoes the body it got on stdin
+        assert body == b"hello\n"
+
+
+def test_duplicate_host():
+    """Test that a request with two Host headers gets 400."""
+    with socket.create_connection(("127.0.0.1", 8080), timeout=5) as sock:
+        sock.sendall(b"GET /index.html HTTP/1.1\r\nHost: 127.0.0.1\r\nhost: example.com\r\n\r\n")
+        status_line = read_status_line(sock)
+    assert status_line.startswith(b"HTTP/1.1 400"), status_line
+
+
+def test_connection_close_only_closes_its_client():
+    """
+    Test that Connection: close, in any case, closes only the connection that
+    sent it, a keep-alive client served before and after stays open.
+    """
+    request = b"GET /index.html HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n"
+    with socket.create_connection(("127.0.0.1", 8080), timeout=5) as keep_alive:
+        keep_alive.sendall(request)
+        assert read_response(keep_alive)[0].startswith(b"HTTP/1.1 200")
+        with socket.create_connection(("127.0.0.1", 8080), timeout=5) as closing:
+            closing.sendall(b"GET /index.html HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: CLOSE\r\n\r\n")
+            assert read_response(closing)[0].startswith(b"HTTP/1.1 200")
+            assert closing.recv(1024) == b""
+        for _ in range(3):
+            keep_alive.sendall(request)
+            assert read_response(keep_alive)[0].startswith(b"HTTP/1.1 200")
+
+
+def test_bad_percent_escapes():
+    """Test that a %00 or malformed escape in the path gets 400."""
+    for target in (b"/index%00.html", b"/index%zz.html", b"/index%2"):
+        with socket.create_connection(("127.0.0.1", 8080), timeout=5) as sock:
+            sock.sendall(b"GET " + target + b" HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n")
+            status_line = read_status_line(sock)
+        assert status_line.startswith(b"HTTP/1.1 400"), (target, status_line)
+
+
+def test_percent_decoding_path_not_query():
+    """
+    Test that %20 is decoded in the path, where the space it becomes is
+    refused, and passed through as is in the query string.
+    """
+    with socket.create_connection(("127.0.0.1", 8080), timeout=5) as sock:
+        sock.sendall(b"GET /a%20b HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n")
+        status_line = read_status_line(sock)
+    assert status_line.startswith(b"HTTP/1.1 403"), status_line
+    with socket.create_connection(("127.0.0.1", 8080), timeout=5) as sock:
+        sock.sendall(b"GET /cgi/test.py?x=a%20b HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n")
+        header, body = read_response(sock)
+    assert header.startswith(b"HTTP/1.1 200"), header
+    assert b"Query: x=a%20b" in header + body
+
+
+def test_chunked_extensions_and_trailers():
+    """Test that chunk extensions and a trailer section are skipped, not decoded as body."""
+    with socket.create_connection(("127.0.0.1", 8080), timeout=5) as sock:
+        sock.sendall(b"POST /cgi/test.py HTTP/1.1\r\nHost: 127.0.0.1\r\n"
+                     b"Content-Type: text/plain\r\nTransfer-Encoding: chunked\r\n\r\n"
+                     b"5;name=value\r\nhello\r\n"
+                     b"6;quoted=\"a;b\"\r\n world\r\n"
+                     b"0\r\nX-Trailer: ignored\r\nX-Other: too\r\n\r\n")
+        header, body = read_response(sock)
+    assert header.startswith(b"HTTP/1.1 200"), header
+    assert body == b"hello world\n"
+
+
+def test_bad_chunk_size():
+    """Test that a chunk size that is not hex, or too large, gets 400."""
+    for size_line in (b"zz\r\n", b"5x\r\n", b"ffffffffffffffffff\r\n"):
+        with socket.create_connection(("127.0.0.1", 8080), timeout=5) as sock:
+            sock.sendall(b"POST /cgi/test.py HTTP/1.1\r\nHost: 127.0.0.1\r\n"
+                         b"Transfer-Encoding: chunked\r\n\r\n" + size_line + b"hello\r\n0\r\n\r\n")
+            status_line = read_status_line(sock)
+        assert status_line.startswith(b"HTTP/1.1 400"), (size_line, status_line)